@@ -0,0 +1,304 @@
+#include "gpu_particle_simulation.hpp"
+#include "error_handling.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+// Layout required by glDrawArraysIndirect
+struct DrawArraysIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+constexpr GLuint cWorkGroupSize = 256;
+
+GLuint workGroupCount(std::size_t aInvocations)
+{
+    return static_cast<GLuint>((aInvocations + cWorkGroupSize - 1) / cWorkGroupSize);
+}
+
+OpenGLResource createStorageBuffer(std::size_t aSize)
+{
+    OpenGLResource buffer = createBuffer();
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.get()));
+    GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(aSize), nullptr, GL_DYNAMIC_COPY));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+    return buffer;
+}
+
+std::shared_ptr<OGLShaderProgram> getComputeProgram(MaterialFactory& aMaterialFactory, const std::string& aName)
+{
+    return std::static_pointer_cast<OGLShaderProgram>(aMaterialFactory.getShaderProgram(aName));
+}
+
+} // namespace
+
+GpuParticleSimulation::GpuParticleSimulation(unsigned int aMaxParticles, unsigned int aVertexCount)
+    : mMaxParticles(aMaxParticles)
+    , mParticleQuota(aMaxParticles)
+    , mVertexCount(aVertexCount)
+    // Same stride as ParticleStorage, so upload() and download() copy one block
+    , mStreamStride((aMaxParticles + cParticleLaneWidth - 1) / cParticleLaneWidth * cParticleLaneWidth)
+{
+    const std::size_t stateSize = mStreamStride * ParticleStorage::cStreamCount * sizeof(float);
+    for (std::size_t i = 0; i < mStates.size(); ++i)
+    {
+        mStates[i] = createStorageBuffer(stateSize);
+        mCommands[i] = createStorageBuffer(sizeof(DrawArraysIndirectCommand));
+        resetCommand(mCommands[i].get(), 0);
+    }
+    mInstances = createStorageBuffer(std::size_t(aMaxParticles) * cGpuParticleInstanceWords * sizeof(std::uint32_t));
+    mDrawCommand = createStorageBuffer(sizeof(DrawArraysIndirectCommand));
+    resetCommand(mDrawCommand.get(), 0);
+}
+
+void GpuParticleSimulation::loadPrograms(MaterialFactory& aMaterialFactory)
+{
+    mEmitProgram = getComputeProgram(aMaterialFactory, "particle_emit");
+    mSimulateProgram = getComputeProgram(aMaterialFactory, "particle_simulate");
+    mCompactProgram = getComputeProgram(aMaterialFactory, "particle_compact");
+    mPackProgram = getComputeProgram(aMaterialFactory, "particle_pack");
+}
+
+void GpuParticleSimulation::resetCommand(GLuint aBuffer, unsigned int aInstanceCount)
+{
+    DrawArraysIndirectCommand command{ mVertexCount, aInstanceCount, 0, 0 };
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, aBuffer));
+    GL_CHECK(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), &command));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void GpuParticleSimulation::bindState(std::size_t aSource) const
+{
+    const std::size_t target = 1 - aSource;
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mStates[aSource].get()));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mCommands[aSource].get()));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mStates[target].get()));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mCommands[target].get()));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mInstances.get()));
+}
+
+void GpuParticleSimulation::updateTurbulenceTexture(const CurlNoiseField* aField)
+{
+    if (aField == mTurbulenceField)
+    {
+        return;
+    }
+    mTurbulenceField = aField;
+    mTurbulenceTexture.reset();
+    if (aField)
+    {
+        const int resolution = static_cast<int>(aField->resolution());
+        mTurbulenceTexture = std::make_shared<OGLTexture>(
+            createTiled3DTextureFromData(aField->voxels(), resolution, resolution, resolution), GL_TEXTURE_3D);
+    }
+}
+
+void GpuParticleSimulation::step(const ParticleStepParams& aParams, unsigned int aEmitCount)
+{
+    if (!mEmitProgram || !mSimulateProgram || !mCompactProgram)
+    {
+        throw OpenGLError("GPU particle simulation programs were not loaded");
+    }
+
+    const float dt = aParams.update.dt;
+    updateTurbulenceTexture(aParams.turbulence.field);
+    MaterialParameterValues parameters = {
+        { "u_streamStride", static_cast<unsigned int>(mStreamStride) },
+        { "u_particleQuota", mParticleQuota },
+        { "u_emitCount", aEmitCount },
+        { "u_seed", counterRandomKey(aParams.seed) },
+        { "u_frame", static_cast<unsigned int>(aParams.frame) },
+        { "u_emitterPos", aParams.emitterPos },
+        { "u_dt", dt },
+        { "u_velocityStep", aParams.update.acceleration * dt },
+        { "u_lifeStep", aParams.update.lifeDecay * dt },
+        { "u_turbulenceStep", mTurbulenceTexture ? aParams.turbulence.strength * dt : 0.0f },
+        { "u_turbulenceFrequency", aParams.turbulence.frequency },
+    };
+    if (mTurbulenceTexture)
+    {
+        parameters["u_turbulenceField"] = TextureInfo{ "turbulence", mTurbulenceTexture };
+    }
+
+    const std::size_t target = 1 - mCurrent;
+    resetCommand(mCommands[target].get(), 0);
+    bindState(mCurrent);
+
+    if (aEmitCount > 0)
+    {
+        mEmitProgram->use();
+        mEmitProgram->setMaterialParameters(parameters);
+        GL_CHECK(glDispatchCompute(workGroupCount(std::min(aEmitCount, mParticleQuota)), 1, 1));
+        GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+    }
+
+    mSimulateProgram->use();
+    mSimulateProgram->setMaterialParameters(parameters);
+    GL_CHECK(glDispatchCompute(workGroupCount(mMaxParticles), 1, 1));
+    GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+
+    mCompactProgram->use();
+    mCompactProgram->setMaterialParameters(parameters);
+    GL_CHECK(glDispatchCompute(workGroupCount(mMaxParticles), 1, 1));
+    GL_CHECK(glMemoryBarrier(
+        GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT));
+
+    GL_CHECK(glUseProgram(0));
+    mCurrent = target;
+}
+
+void GpuParticleSimulation::packInstances(float aInterpolation, glm::vec3 aEmitterPos, const GpuParticleCulling& aCulling)
+{
+    if (!mPackProgram)
+    {
+        throw OpenGLError("GPU particle simulation programs were not loaded");
+    }
+
+    // A sphere is outside a frustum plane (row 3 +- row k of the matrix,
+    // Gribb and Hartmann) if it is further than radius * |plane normal| behind it
+    const glm::mat4& m = aCulling.clipFromSimulation;
+    glm::vec3 marginLow(0.0f);
+    glm::vec3 marginHigh(0.0f);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const glm::vec3 row(m[0][axis], m[1][axis], m[2][axis]);
+        const glm::vec3 wRow(m[0][3], m[1][3], m[2][3]);
+        marginLow[axis] = aCulling.radius * glm::length(wRow + row);
+        marginHigh[axis] = aCulling.radius * glm::length(wRow - row);
+    }
+    const MaterialParameterValues parameters = {
+        { "u_streamStride", static_cast<unsigned int>(mStreamStride) },
+        { "u_emitterPos", aEmitterPos },
+        { "u_interpolation", aInterpolation },
+        { "u_frustumCulling", aCulling.enabled ? 1u : 0u },
+        { "u_clipFromSimulation", aCulling.clipFromSimulation },
+        { "u_cullMarginLow", marginLow },
+        { "u_cullMarginHigh", marginHigh },
+    };
+
+    // The visible particles are counted into the draw command
+    resetCommand(mDrawCommand.get(), 0);
+    bindState(mCurrent);
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mDrawCommand.get()));
+
+    // The live count is only known on the GPU, so all slots are dispatched
+    mPackProgram->use();
+    mPackProgram->setMaterialParameters(parameters);
+    GL_CHECK(glDispatchCompute(workGroupCount(mMaxParticles), 1, 1));
+    GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT));
+    GL_CHECK(glUseProgram(0));
+}
+
+void GpuParticleSimulation::upload(const ParticleStorage& aStorage)
+{
+    if (aStorage.paddedCount != mStreamStride)
+    {
+        throw OpenGLError("Particle storage does not match the GPU simulation size");
+    }
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, mStates[mCurrent].get()));
+    GL_CHECK(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, GLsizeiptr(mStreamStride * ParticleStorage::cStreamCount * sizeof(float)), aStorage.positionX));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+    resetCommand(mCommands[mCurrent].get(), static_cast<unsigned int>(aStorage.aliveCount));
+}
+
+void GpuParticleSimulation::download(ParticleStorage& aStorage)
+{
+    if (aStorage.paddedCount != mStreamStride)
+    {
+        throw OpenGLError("Particle storage does not match the GPU simulation size");
+    }
+    DrawArraysIndirectCommand command{};
+    GL_CHECK(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, mStates[mCurrent].get()));
+    GL_CHECK(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, GLsizeiptr(mStreamStride * ParticleStorage::cStreamCount * sizeof(float)), aStorage.positionX));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCommands[mCurrent].get()));
+    GL_CHECK(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), &command));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+    aStorage.aliveCount = command.instanceCount;
+}
+
+// Live particles ordered by values that are set once at emission and are
+// bit-identical on both backends, so they can be compared regardless of
+// compaction order.
+static std::vector<std::size_t> stableParticleOrder(const ParticleStorage& aStorage)
+{
+    std::vector<std::size_t> order(aStorage.aliveCount);
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return std::make_tuple(aStorage.initialLife[a], aStorage.scale[a], aStorage.velocityX[a], aStorage.velocityZ[a])
+            < std::make_tuple(aStorage.initialLife[b], aStorage.scale[b], aStorage.velocityX[b], aStorage.velocityZ[b]);
+    });
+    return order;
+}
+
+bool verifyGpuParticleSimulation(MaterialFactory& aMaterialFactory, std::ostream& aStream, std::size_t aParticleCount, int aSteps)
+{
+    const float cTolerance = 1e-5f;
+    WorkerPool& pool = WorkerPool::shared();
+
+    ParticleStepParams params;
+    params.update.dt = 1.0f / 60.0f;
+    params.seed = 0x5EED;
+
+    // Both backends start empty and get the same emission requests.
+    // Particles live 26 to 54 steps, so the comparison covers emission,
+    // integration and deaths.
+    ParticleStorage cpu;
+    cpu.resize(aParticleCount);
+    ParticleEmitter emitter(float(aParticleCount) * params.update.lifeDecay);
+    emitter.burst(static_cast<unsigned int>(aParticleCount / 2));
+
+    GpuParticleSimulation gpu(static_cast<unsigned int>(aParticleCount), 0);
+    gpu.loadPrograms(aMaterialFactory);
+    gpu.upload(cpu);
+
+    for (int step = 0; step < aSteps; ++step)
+    {
+        params.frame = static_cast<std::uint64_t>(step);
+        const unsigned int emitCount = emitter.takeEmission(params.update.dt);
+        simulateParticles(cpu, params, emitCount, pool);
+        gpu.step(params, emitCount);
+    }
+
+    ParticleStorage result;
+    result.resize(aParticleCount);
+    gpu.download(result);
+
+    bool passed = cpu.aliveCount == result.aliveCount;
+    float maxError = 0.0f;
+    if (passed)
+    {
+        const auto cpuOrder = stableParticleOrder(cpu);
+        const auto gpuOrder = stableParticleOrder(result);
+        const auto cpuStreams = cpu.streams();
+        const auto gpuStreams = result.streams();
+        for (std::size_t stream = 0; stream < ParticleStorage::cStreamCount; ++stream)
+        {
+            for (std::size_t i = 0; i < cpuOrder.size(); ++i)
+            {
+                maxError = std::max(maxError, std::abs(cpuStreams[stream][cpuOrder[i]] - gpuStreams[stream][gpuOrder[i]]));
+            }
+        }
+        passed = maxError <= cTolerance;
+    }
+
+    aStream << "GPU particle verification, " << aParticleCount << " particles, " << aSteps << " steps\n"
+        << "  alive: cpu " << cpu.aliveCount << ", gpu " << result.aliveCount << "\n"
+        << "  max abs error: " << std::scientific << std::setprecision(3) << maxError << std::defaultfloat
+        << " (tolerance " << cTolerance << ")\n"
+        << "  " << (passed ? "PASSED" : "FAILED") << "\n";
+    return passed;
+}
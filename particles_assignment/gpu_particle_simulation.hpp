@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <glad/glad.h>
+
+#include "ogl_resource.hpp"
+#include "ogl_material_factory.hpp"
+#include "particle_storage.hpp"
+#include "particle_simulation.hpp"
+
+// 32-bit words per rendered instance written by particle_pack.compute.glsl,
+// matching ParticleInstance (particle_kernels.hpp)
+constexpr std::size_t cGpuParticleInstanceWords = 4;
+
+// Frustum culling of whole particle quads in GpuParticleSimulation::packInstances()
+struct GpuParticleCulling
+{
+    bool enabled = false;
+    // projection * view * model of the particle system
+    glm::mat4 clipFromSimulation = glm::mat4(1.0f);
+    // Radius around a particle that contains its quad, in simulation units
+    float radius = 0.0f;
+};
+
+/**
+ * @brief Particle simulation that keeps all state in shader storage buffers.
+ *
+ * Each step runs three compute passes, the same phases as simulateParticles():
+ *  - particle_emit:     spawns particles behind the live ones,
+ *  - particle_simulate: integrates the pooled particles in place,
+ *  - particle_compact:  copies survivors into the other state buffer.
+ * packInstances() runs particle_pack once per rendered frame and writes the
+ * instance buffer used for drawing, interpolated between the last two steps.
+ * It skips particles outside the view frustum and counts the others in a
+ * separate draw command, so hidden particles never reach the vertex stage.
+ *
+ * A turbulence field in the step parameters is uploaded once as a 3D texture
+ * and sampled by particle_simulate with hardware trilinear filtering.
+ *
+ * The live and the visible count are only kept in DrawArraysIndirectCommands,
+ * so drawing with drawCommandBuffer() needs no read back. upload() and download() copy
+ * the whole state and exist for verification against the CPU backend.
+ */
+class GpuParticleSimulation
+{
+public:
+    // aVertexCount is the vertex count of the geometry drawn per particle
+    GpuParticleSimulation(unsigned int aMaxParticles, unsigned int aVertexCount);
+
+    // Compute programs are compiled by the material factory from the shader directory
+    void loadPrograms(MaterialFactory& aMaterialFactory);
+
+    // Emission stops at aQuota live particles, at most the capacity
+    void setParticleQuota(unsigned int aQuota) { mParticleQuota = std::min(aQuota, mMaxParticles); }
+
+    void step(const ParticleStepParams& aParams, unsigned int aEmitCount);
+    // Writes the instances of the visible live particles, see packParticleInstances()
+    void packInstances(float aInterpolation, glm::vec3 aEmitterPos, const GpuParticleCulling& aCulling = GpuParticleCulling());
+
+    void upload(const ParticleStorage& aStorage);
+    // Blocks until the GPU is done. The order of live particles differs from
+    // the CPU backend, see particle_compact.compute.glsl.
+    void download(ParticleStorage& aStorage);
+
+    GLuint instanceBuffer() const { return mInstances.get(); }
+    // Instance count is the number of instances written by the last packInstances()
+    GLuint drawCommandBuffer() const { return mDrawCommand.get(); }
+
+private:
+    void bindState(std::size_t aSource) const;
+    void resetCommand(GLuint aBuffer, unsigned int aInstanceCount);
+    void updateTurbulenceTexture(const CurlNoiseField* aField);
+
+    unsigned int mMaxParticles;
+    unsigned int mParticleQuota;
+    unsigned int mVertexCount;
+    std::size_t mStreamStride;
+
+    // Ping-pong state: mCurrent holds the particles drawn this frame
+    std::array<OpenGLResource, 2> mStates;
+    std::array<OpenGLResource, 2> mCommands;
+    std::size_t mCurrent = 0;
+    OpenGLResource mInstances;
+    OpenGLResource mDrawCommand;
+
+    std::shared_ptr<OGLShaderProgram> mEmitProgram;
+    std::shared_ptr<OGLShaderProgram> mSimulateProgram;
+    std::shared_ptr<OGLShaderProgram> mCompactProgram;
+    std::shared_ptr<OGLShaderProgram> mPackProgram;
+
+    // 3D texture of the turbulence field last seen in the step parameters
+    const CurlNoiseField* mTurbulenceField = nullptr;
+    std::shared_ptr<OGLTexture> mTurbulenceTexture;
+};
+
+// Runs the same emission and steps on both backends and compares the
+// results. Returns true if the live counts match and every
+// value is within tolerance. Needs a current GL 4.3+ context.
+bool verifyGpuParticleSimulation(MaterialFactory& aMaterialFactory, std::ostream& aStream, std::size_t aParticleCount = 100000, int aSteps = 60);
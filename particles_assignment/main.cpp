@@ -14,6 +14,8 @@
 #include "scene_definition.hpp"
 #include "renderer.hpp"
 #include "particle_system.h"
+#include "particle_world.hpp"
+#include "particle_budget.hpp"
 
 #include "ogl_geometry_factory.hpp"
 #include "ogl_material_factory.hpp"
@@ -35,8 +37,63 @@ struct Config
 	bool showSolid = true;
 	bool showWireframe = false;
 	bool showNormals = false;
+	bool verifyGpuParticles = false;
+	// Screen to particle target resolution ratio, see Renderer::setParticleDownsample()
+	int particleDownsample = 1;
+	// Particle snapshot and replay requests, handled in the render loop
+	bool saveParticleSnapshot = false;
+	bool loadParticleSnapshot = false;
+	bool toggleParticleRecording = false;
+	bool toggleParticleReplay = false;
 };
 
+// Snapshot and replay files are named after the particle system and written
+// to the working directory
+void handleParticleSnapshotKeys(const Config& aConfig, ParticleSystem& aParticles)
+{
+	const std::string snapshotPath = aParticles.getName() + ".snapshot";
+	const std::string replayPath = aParticles.getName() + ".replay";
+	if (aConfig.saveParticleSnapshot)
+	{
+		std::cout << "Save particle snapshot " << snapshotPath << ": " << (aParticles.saveSnapshot(snapshotPath) ? "OK\n" : "FAILED\n");
+	}
+	if (aConfig.loadParticleSnapshot)
+	{
+		std::cout << "Load particle snapshot " << snapshotPath << ": " << (aParticles.loadSnapshot(snapshotPath) ? "OK\n" : "FAILED\n");
+	}
+	if (aConfig.toggleParticleRecording)
+	{
+		if (aParticles.isRecording())
+		{
+			aParticles.stopRecording();
+			std::cout << "Particle recording: OFF\n";
+		}
+		else
+		{
+			std::cout << "Particle recording " << replayPath << ": " << (aParticles.startRecording(replayPath) ? "ON\n" : "FAILED\n");
+		}
+	}
+	if (aConfig.toggleParticleReplay)
+	{
+		if (aParticles.isReplaying())
+		{
+			aParticles.setReplay(nullptr);
+			std::cout << "Particle replay: OFF\n";
+		}
+		else
+		{
+			// A replay of the file being written would see no frame table yet
+			aParticles.stopRecording();
+			std::optional<ParticleInstanceReplay> replay = ParticleInstanceReplay::open(replayPath);
+			if (replay)
+			{
+				aParticles.setReplay(std::make_shared<ParticleInstanceReplay>(std::move(*replay)));
+			}
+			std::cout << "Particle replay " << replayPath << ": " << (aParticles.isReplaying() ? "ON\n" : "FAILED\n");
+		}
+	}
+}
+
 int main()
 {
 	if (!glfwInit())
@@ -88,6 +145,15 @@ int main()
 					case GLFW_KEY_4:
 						config.currentSceneIdx = 3;
 						break;
+					case GLFW_KEY_5:
+						config.currentSceneIdx = 4;
+						break;
+					case GLFW_KEY_6:
+						config.currentSceneIdx = 5;
+						break;
+					case GLFW_KEY_7:
+						config.currentSceneIdx = 6;
+						break;
 					case GLFW_KEY_W:
 						toggle("Show wireframe", config.showWireframe);
 						break;
@@ -97,6 +163,30 @@ int main()
 					case GLFW_KEY_S:
 						toggle("Show solid", config.showSolid);
 						break;
+					case GLFW_KEY_P:
+						reportParticleScaling(std::cout);
+						break;
+					case GLFW_KEY_G:
+						// Needs the material factory, handled in the render loop
+						config.verifyGpuParticles = true;
+						break;
+					case GLFW_KEY_F5:
+						config.saveParticleSnapshot = true;
+						break;
+					case GLFW_KEY_F9:
+						config.loadParticleSnapshot = true;
+						break;
+					case GLFW_KEY_R:
+						config.toggleParticleRecording = true;
+						break;
+					case GLFW_KEY_Y:
+						config.toggleParticleReplay = true;
+						break;
+					case GLFW_KEY_L:
+						// Full, half and quarter resolution particles
+						config.particleDownsample = config.particleDownsample >= 4 ? 1 : config.particleDownsample * 2;
+						std::cout << "Particle resolution: 1/" << config.particleDownsample << "\n";
+						break;
 					}
 				}
 			});
@@ -108,34 +198,62 @@ int main()
 
 		OGLGeometryFactory geometryFactory;
 
-		std::array<SimpleScene, 4> scenes{
+		std::array<SimpleScene, 7> scenes{
 			createCubeScene(materialFactory, geometryFactory),
 			createInstancedCubesScene(materialFactory, geometryFactory),
 			createMonkeyScene(materialFactory, geometryFactory),
 			createParticleScene(materialFactory, geometryFactory),
+			createParticleScene(materialFactory, geometryFactory, ParticleBackend::Gpu),
+			createParticleScene(materialFactory, geometryFactory, ParticleBackend::Analytic),
+			createParticleWorldScene(materialFactory, geometryFactory),
 		};
 
 		Renderer renderer(materialFactory);
+		ParticleBudget particleBudget;
 
 		renderer.initialize();
+		// Scene setup can take seconds, so the first frame must not count from 0
+		float lastFrame = static_cast<float>(glfwGetTime());
 		window.runLoop([&]
 			{
 				float currentTime = static_cast<float>(glfwGetTime());
-				static float lastFrame = 0.0f;
 				float deltaTime = currentTime - lastFrame;
 				lastFrame = currentTime;
 
+				if (config.verifyGpuParticles)
+				{
+					config.verifyGpuParticles = false;
+					verifyGpuParticleSimulation(materialFactory, std::cout);
+				}
+
 				auto& scene = scenes[config.currentSceneIdx];
+				particleBudget.apply(scene, camera);
 				for (auto& obj : scene.getObjects())
 				{
 					if (const auto* ps = dynamic_cast<const ParticleSystem*>(&obj))
 					{
+						handleParticleSnapshotKeys(config, *const_cast<ParticleSystem*>(ps));
+						const_cast<ParticleSystem*>(ps)->updateCameraVectors(camera.getViewMatrix(), camera.getProjectionMatrix());
 						const_cast<ParticleSystem*>(ps)->update(deltaTime, ps->getPosition());
-						const_cast<ParticleSystem*>(ps)->updateCameraVectors(camera.getViewMatrix());
 					}
 				}
+				// Worlds pack the particles of their members, which are updated now
+				for (auto& obj : scene.getObjects())
+				{
+					if (const auto* world = dynamic_cast<const ParticleWorld*>(&obj))
+					{
+						const_cast<ParticleWorld*>(world)->updateCameraVectors(camera.getViewMatrix());
+						const_cast<ParticleWorld*>(world)->update();
+					}
+				}
+
+				config.saveParticleSnapshot = false;
+				config.loadParticleSnapshot = false;
+				config.toggleParticleRecording = false;
+				config.toggleParticleReplay = false;
 
 				renderer.clear();
+				renderer.setParticleDownsample(config.particleDownsample);
 
 				if (config.showSolid)
 				{
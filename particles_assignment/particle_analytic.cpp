@@ -0,0 +1,41 @@
+#include "particle_analytic.hpp"
+
+#include <algorithm>
+
+static std::uint32_t packUnorm8(float aValue)
+{
+    return static_cast<std::uint32_t>(std::clamp(aValue, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+std::size_t spawnAnalyticParticles(ParticleStorage& aScratch, std::size_t aCount, const ParticleStepParams& aParams, WorkerPool& aPool, AnalyticParticle* aParticles)
+{
+    if (aScratch.count < aCount)
+    {
+        aScratch.resize(aCount);
+    }
+    aScratch.aliveCount = 0;
+    const std::size_t emitted = emitParticles(aScratch, aCount, aParams, aPool);
+
+    const std::uint32_t step = static_cast<std::uint32_t>(aParams.frame);
+    aPool.parallelFor(particleChunkCount(emitted), [&](std::size_t aChunk) {
+        const std::size_t end = std::min(emitted, (aChunk + 1) * cParticleChunkSize);
+        for (std::size_t i = aChunk * cParticleChunkSize; i < end; ++i)
+        {
+            AnalyticParticle& particle = aParticles[i];
+            particle.position[0] = aScratch.positionX[i];
+            particle.position[1] = aScratch.positionY[i];
+            particle.position[2] = aScratch.positionZ[i];
+            particle.initialLife = aScratch.initialLife[i];
+            particle.velocity[0] = aScratch.velocityX[i];
+            particle.velocity[1] = aScratch.velocityY[i];
+            particle.velocity[2] = aScratch.velocityZ[i];
+            particle.color = packUnorm8(aScratch.colorR[i])
+                | (packUnorm8(aScratch.colorG[i]) << 8)
+                | (packUnorm8(aScratch.colorB[i]) << 16)
+                | (packUnorm8(aScratch.colorA[i]) << 24);
+            particle.spawnStep = step;
+            particle.scale = aScratch.scale[i];
+        }
+    });
+    return emitted;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "particle_simulation.hpp"
+#include "particle_storage.hpp"
+#include "worker_pool.hpp"
+
+// Spawn record of a particle of the analytic backend. Motion is ballistic,
+// so the vertex shader evaluates position and life in closed form from this
+// record and the step counter; nothing is simulated or uploaded per frame.
+struct AnalyticParticle
+{
+    float position[3];       // spawn position in simulation space
+    float initialLife;       // 0 for slots that were never written
+    float velocity[3];       // spawn velocity
+    std::uint32_t color;     // RGBA8 unorm tint, red in the lowest byte
+    std::uint32_t spawnStep; // ParticleStepParams::frame of the step that emitted it
+    float scale;             // multiplies the quad size, see ParticleInstance::scale
+};
+static_assert(sizeof(AnalyticParticle) == 40, "The layout is shared with particle.vertex.glsl");
+
+// Spawns aCount particles for the step in aParams with respawnParticle(),
+// like emitParticles(), and writes their records to aParticles. aScratch is
+// grown to aCount as needed and only holds the particles of this call.
+// Returns aCount.
+std::size_t spawnAnalyticParticles(ParticleStorage& aScratch, std::size_t aCount, const ParticleStepParams& aParams, WorkerPool& aPool, AnalyticParticle* aParticles);
@@ -0,0 +1,89 @@
+#include "particle_budget.hpp"
+
+#include <algorithm>
+
+// Fraction of the screen covered by a sphere of aRadius at aDistance
+static float screenCoverage(float aRadius, float aDistance, float aTanHalfFovY, float aAspectRatio)
+{
+    // Inside or touching the bounds, the system fills the view
+    if (aDistance <= aRadius)
+    {
+        return 1.0f;
+    }
+    // Projected radius in units of the half screen height; the screen is
+    // 2 * aspect by 2 of those units
+    const float radius = aRadius / (aDistance * aTanHalfFovY);
+    return std::min(1.0f, 3.14159f * radius * radius / (4.0f * aAspectRatio));
+}
+
+// Screen coverage of one particle quad of edge length aSize
+static float particleCoverage(float aSize, float aDistance, float aTanHalfFovY, float aAspectRatio)
+{
+    const float edge = aSize / (std::max(aDistance, 1e-3f) * aTanHalfFovY * 2.0f);
+    return std::min(1.0f, edge * edge / aAspectRatio);
+}
+
+std::vector<ParticleBudgetAllocation> allocateParticleBudget(
+    const ParticleBudgetSettings& aSettings,
+    const std::vector<ParticleBudgetRequest>& aRequests,
+    float aTanHalfFovY,
+    float aAspectRatio,
+    ParticleBudgetTotals* aTotals)
+{
+    std::vector<float> quotas(aRequests.size());
+    std::vector<ParticleBudgetAllocation> allocations(aRequests.size());
+
+    // Distance LOD: full capacity down to fullDetailCoverage, then linear in coverage
+    float totalQuota = 0.0f;
+    for (std::size_t i = 0; i < aRequests.size(); ++i)
+    {
+        const auto& request = aRequests[i];
+        const float coverage = screenCoverage(request.boundingRadius, request.distance, aTanHalfFovY, aAspectRatio);
+        const float detail = std::min(1.0f, coverage / aSettings.fullDetailCoverage);
+        quotas[i] = request.capacity * detail;
+        totalQuota += quotas[i];
+    }
+
+    // Global particle cap
+    if (totalQuota > float(aSettings.maxParticles))
+    {
+        const float factor = float(aSettings.maxParticles) / totalQuota;
+        for (float& quota : quotas)
+        {
+            quota *= factor;
+        }
+    }
+
+    // Fewer particles are drawn larger so the effect keeps its coverage,
+    // count * size^2 stays constant up to maxSizeScale
+    float totalFill = 0.0f;
+    for (std::size_t i = 0; i < aRequests.size(); ++i)
+    {
+        const auto& request = aRequests[i];
+        float& sizeScale = allocations[i].sizeScale;
+        sizeScale = quotas[i] > 0.0f ? std::sqrt(request.capacity / quotas[i]) : aSettings.maxSizeScale;
+        sizeScale = std::clamp(sizeScale, 1.0f, aSettings.maxSizeScale);
+        totalFill += quotas[i] * particleCoverage(request.particleSize * sizeScale, request.distance, aTanHalfFovY, aAspectRatio);
+    }
+
+    // Fill cap; sizes stay, so fill drops with the particle count
+    float fillFactor = 1.0f;
+    if (totalFill > aSettings.maxFill)
+    {
+        fillFactor = aSettings.maxFill / totalFill;
+    }
+
+    unsigned int totalParticles = 0;
+    for (std::size_t i = 0; i < aRequests.size(); ++i)
+    {
+        allocations[i].quota = std::min(aRequests[i].capacity, static_cast<unsigned int>(quotas[i] * fillFactor));
+        totalParticles += allocations[i].quota;
+    }
+
+    if (aTotals)
+    {
+        aTotals->particles = totalParticles;
+        aTotals->fill = totalFill * fillFactor;
+    }
+    return allocations;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particle_system.h"
+
+struct ParticleBudgetSettings
+{
+    // Live particles over all systems in the scene
+    unsigned int maxParticles = 200000;
+    // Summed screen coverage of all particle quads, in screens (overdraw)
+    float maxFill = 16.0f;
+    // A system whose bounds cover this fraction of the screen gets its full capacity
+    float fullDetailCoverage = 0.05f;
+    // Largest enlargement of particles in systems running below capacity
+    float maxSizeScale = 3.0f;
+};
+
+// What the budget needs to know about one particle system
+struct ParticleBudgetRequest
+{
+    unsigned int capacity = 0;
+    float distance = 0.0f;
+    float boundingRadius = 0.0f;
+    // World-space edge length of a particle quad at size scale 1
+    float particleSize = 0.0f;
+};
+
+struct ParticleBudgetAllocation
+{
+    unsigned int quota = 0;
+    float sizeScale = 1.0f;
+};
+
+struct ParticleBudgetTotals
+{
+    unsigned int particles = 0;
+    float fill = 0.0f;
+};
+
+// Distributes the budget over the requests. Systems that look small on
+// screen get fewer, larger particles; if the scene still exceeds the
+// particle or fill cap, all quotas are scaled down proportionally.
+std::vector<ParticleBudgetAllocation> allocateParticleBudget(
+    const ParticleBudgetSettings& aSettings,
+    const std::vector<ParticleBudgetRequest>& aRequests,
+    float aTanHalfFovY,
+    float aAspectRatio,
+    ParticleBudgetTotals* aTotals = nullptr);
+
+/**
+ * @brief Scene-level particle budget and distance LOD.
+ *
+ * Call apply() once per frame before the particle systems are updated. It
+ * hands every ParticleSystem in the scene a quota (live particle limit,
+ * emission is throttled to match) and a particle size scale.
+ */
+class ParticleBudget
+{
+public:
+    explicit ParticleBudget(ParticleBudgetSettings aSettings = {}) : mSettings(aSettings) {}
+
+    ParticleBudgetSettings& settings() { return mSettings; }
+    const ParticleBudgetTotals& lastTotals() const { return mTotals; }
+
+    template<typename TScene, typename TCamera>
+    void apply(const TScene& aScene, const TCamera& aCamera)
+    {
+        std::vector<ParticleSystem*> systems;
+        std::vector<ParticleBudgetRequest> requests;
+        for (const auto& object : aScene.getObjects())
+        {
+            if (const auto* ps = dynamic_cast<const ParticleSystem*>(&object))
+            {
+                auto* system = const_cast<ParticleSystem*>(ps);
+                systems.push_back(system);
+                requests.push_back(ParticleBudgetRequest{
+                    system->getMaxParticles(),
+                    glm::length(system->getPosition() - aCamera.getPosition()),
+                    system->getBoundingRadius(),
+                    system->getParticleSize()
+                });
+            }
+        }
+
+        const float tanHalfFovY = std::tan(glm::radians(aCamera.fieldOfView()) * 0.5f);
+        const auto allocations = allocateParticleBudget(mSettings, requests, tanHalfFovY, aCamera.getAspectRatio(), &mTotals);
+        for (std::size_t i = 0; i < systems.size(); ++i)
+        {
+            systems[i]->setParticleQuota(allocations[i].quota);
+            systems[i]->setParticleSizeScale(allocations[i].sizeScale);
+        }
+    }
+
+private:
+    ParticleBudgetSettings mSettings;
+    ParticleBudgetTotals mTotals;
+};
@@ -0,0 +1,468 @@
+#include "particle_collision.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+constexpr char cCacheMagic[8] = { 'P', 'S', 'D', 'F', '0', '0', '0', '1' };
+
+struct CacheHeader
+{
+    char magic[8];
+    std::uint64_t sourceKey;
+    std::uint32_t dimensions[3];
+    float origin[3];
+    float cellSize;
+};
+
+struct Triangle
+{
+    glm::vec3 a, b, c;
+};
+
+// Closest point on a triangle, Ericson, Real-Time Collision Detection 5.1.5
+float distanceToTriangle(glm::vec3 aPoint, const Triangle& aTriangle)
+{
+    const glm::vec3 ab = aTriangle.b - aTriangle.a;
+    const glm::vec3 ac = aTriangle.c - aTriangle.a;
+    const glm::vec3 ap = aPoint - aTriangle.a;
+    const float d1 = glm::dot(ab, ap);
+    const float d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    {
+        return glm::length(ap);
+    }
+
+    const glm::vec3 bp = aPoint - aTriangle.b;
+    const float d3 = glm::dot(ab, bp);
+    const float d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+    {
+        return glm::length(bp);
+    }
+
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        return glm::length(ap - ab * (d1 / (d1 - d3)));
+    }
+
+    const glm::vec3 cp = aPoint - aTriangle.c;
+    const float d5 = glm::dot(ab, cp);
+    const float d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+    {
+        return glm::length(cp);
+    }
+
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    {
+        return glm::length(ap - ac * (d2 / (d2 - d6)));
+    }
+
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    {
+        return glm::length(bp - (aTriangle.c - aTriangle.b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))));
+    }
+
+    const float denominator = 1.0f / (va + vb + vc);
+    return glm::length(ap - ab * (vb * denominator) - ac * (vc * denominator));
+}
+
+std::uint64_t fnv1a(std::uint64_t aHash, const void* aData, std::size_t aSize)
+{
+    const auto* bytes = static_cast<const unsigned char*>(aData);
+    for (std::size_t i = 0; i < aSize; ++i)
+    {
+        aHash = (aHash ^ bytes[i]) * 1099511628211ull;
+    }
+    return aHash;
+}
+
+// Twice the signed area of (origin, 1, 2), with a consistent tie-break
+// when the origin lies on the edge, so a ray through an edge shared by two
+// triangles hits exactly one of them.
+int orientation(double aU1, double aV1, double aU2, double aV2, double& aTwiceArea)
+{
+    aTwiceArea = aV1 * aU2 - aU1 * aV2;
+    if (aTwiceArea != 0.0)
+    {
+        return aTwiceArea > 0.0 ? 1 : -1;
+    }
+    if (aV2 != aV1)
+    {
+        return aV2 > aV1 ? 1 : -1;
+    }
+    if (aU1 != aU2)
+    {
+        return aU1 > aU2 ? 1 : -1;
+    }
+    return 0;
+}
+
+// Grid nodes in [ceil(aMin), floor(aMax)] along one axis, clamped to the grid
+std::array<int, 2> nodeRange(float aMin, float aMax, int aMargin, int aCount)
+{
+    return {
+        std::max(0, int(std::ceil(aMin)) - aMargin),
+        std::min(aCount - 1, int(std::floor(aMax)) + aMargin)
+    };
+}
+
+} // namespace
+
+MeshDistanceField MeshDistanceField::bake(const ObjMesh& aMesh, const MeshDistanceFieldSettings& aSettings, WorkerPool& aPool)
+{
+    std::vector<Triangle> triangles;
+    triangles.reserve(aMesh.indices.size() / 3);
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+    for (std::size_t i = 0; i + 2 < aMesh.indices.size(); i += 3)
+    {
+        const Triangle triangle{
+            aMesh.vertices[aMesh.indices[i]].position,
+            aMesh.vertices[aMesh.indices[i + 1]].position,
+            aMesh.vertices[aMesh.indices[i + 2]].position
+        };
+        boundsMin = glm::min(boundsMin, glm::min(triangle.a, glm::min(triangle.b, triangle.c)));
+        boundsMax = glm::max(boundsMax, glm::max(triangle.a, glm::max(triangle.b, triangle.c)));
+        triangles.push_back(triangle);
+    }
+    if (triangles.empty())
+    {
+        throw std::invalid_argument("Cannot bake a distance field without triangles");
+    }
+
+    MeshDistanceField field;
+    const glm::vec3 extent = boundsMax - boundsMin;
+    const float longest = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+    field.mCellSize = longest / float(std::max<std::size_t>(aSettings.resolution, 1));
+    field.mOrigin = boundsMin - float(aSettings.padding) * field.mCellSize;
+    field.mDimensions = glm::max(glm::uvec3(glm::ceil(extent / field.mCellSize)) + glm::uvec3(2 * aSettings.padding + 1), glm::uvec3(2));
+
+    const glm::ivec3 dims(field.mDimensions);
+    const std::size_t nodeCount = std::size_t(dims.x) * dims.y * dims.z;
+
+    // Triangles in grid units, so node (i, j, k) is at (i, j, k)
+    for (Triangle& triangle : triangles)
+    {
+        triangle.a = (triangle.a - field.mOrigin) / field.mCellSize;
+        triangle.b = (triangle.b - field.mOrigin) / field.mCellSize;
+        triangle.c = (triangle.c - field.mOrigin) / field.mCellSize;
+    }
+
+    // Lists the triangles whose nodes along aAxis (widened by aMargin) include each layer
+    auto bucketTriangles = [&](int aAxis, int aMargin) {
+        std::vector<std::vector<std::uint32_t>> buckets(dims[aAxis]);
+        for (std::size_t t = 0; t < triangles.size(); ++t)
+        {
+            const Triangle& triangle = triangles[t];
+            const auto range = nodeRange(
+                std::min(triangle.a[aAxis], std::min(triangle.b[aAxis], triangle.c[aAxis])),
+                std::max(triangle.a[aAxis], std::max(triangle.b[aAxis], triangle.c[aAxis])),
+                aMargin, dims[aAxis]);
+            for (int layer = range[0]; layer <= range[1]; ++layer)
+            {
+                buckets[layer].push_back(static_cast<std::uint32_t>(t));
+            }
+        }
+        return buckets;
+    };
+
+    // 1. Exact distances in a band of one cell around each triangle. Each
+    //    task owns one z layer of nodes.
+    std::vector<float> distances(nodeCount, std::numeric_limits<float>::max());
+    std::vector<std::int32_t> closest(nodeCount, -1);
+    {
+        const auto buckets = bucketTriangles(2, 1);
+        aPool.parallelFor(std::size_t(dims.z), [&](std::size_t aLayer) {
+            const int z = static_cast<int>(aLayer);
+            for (std::uint32_t t : buckets[aLayer])
+            {
+                const Triangle& triangle = triangles[t];
+                const glm::vec3 low = glm::min(triangle.a, glm::min(triangle.b, triangle.c));
+                const glm::vec3 high = glm::max(triangle.a, glm::max(triangle.b, triangle.c));
+                const auto rangeX = nodeRange(low.x, high.x, 1, dims.x);
+                const auto rangeY = nodeRange(low.y, high.y, 1, dims.y);
+                for (int y = rangeY[0]; y <= rangeY[1]; ++y)
+                {
+                    for (int x = rangeX[0]; x <= rangeX[1]; ++x)
+                    {
+                        const std::size_t node = field.index(x, y, z);
+                        const float distance = distanceToTriangle(glm::vec3(float(x), float(y), float(z)), triangle);
+                        if (distance < distances[node])
+                        {
+                            distances[node] = distance;
+                            closest[node] = static_cast<std::int32_t>(t);
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    // 2. Fast sweeping: each node tries the closest triangles of its
+    //    upwind neighbours, in all eight diagonal directions, twice.
+    auto tryNeighbour = [&](std::size_t aNode, int aX, int aY, int aZ, std::size_t aNeighbour) {
+        const std::int32_t candidate = closest[aNeighbour];
+        if (candidate < 0 || candidate == closest[aNode])
+        {
+            return;
+        }
+        const float distance = distanceToTriangle(glm::vec3(float(aX), float(aY), float(aZ)), triangles[candidate]);
+        if (distance < distances[aNode])
+        {
+            distances[aNode] = distance;
+            closest[aNode] = candidate;
+        }
+    };
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (int direction = 0; direction < 8; ++direction)
+        {
+            const int dx = (direction & 1) ? -1 : 1;
+            const int dy = (direction & 2) ? -1 : 1;
+            const int dz = (direction & 4) ? -1 : 1;
+            for (int z = dz > 0 ? 1 : dims.z - 2; z >= 0 && z < dims.z; z += dz)
+            {
+                for (int y = dy > 0 ? 1 : dims.y - 2; y >= 0 && y < dims.y; y += dy)
+                {
+                    for (int x = dx > 0 ? 1 : dims.x - 2; x >= 0 && x < dims.x; x += dx)
+                    {
+                        const std::size_t node = field.index(x, y, z);
+                        tryNeighbour(node, x, y, z, field.index(x - dx, y, z));
+                        tryNeighbour(node, x, y, z, field.index(x, y - dy, z));
+                        tryNeighbour(node, x, y, z, field.index(x - dx, y - dy, z));
+                        tryNeighbour(node, x, y, z, field.index(x, y, z - dz));
+                        tryNeighbour(node, x, y, z, field.index(x - dx, y, z - dz));
+                        tryNeighbour(node, x, y, z, field.index(x, y - dy, z - dz));
+                        tryNeighbour(node, x, y, z, field.index(x - dx, y - dy, z - dz));
+                    }
+                }
+            }
+        }
+    }
+
+    // 3. Inside or outside: rays along each axis through every row of nodes
+    //    count the triangles they cross. A node is inside where at least two
+    //    of the three rays crossed an odd number of times.
+    std::vector<std::uint8_t> insideVotes(nodeCount, 0);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+        std::vector<std::uint8_t> crossings(nodeCount, 0);
+        const auto buckets = bucketTriangles(v, 0);
+
+        // Each task owns the rows of one layer along v
+        aPool.parallelFor(std::size_t(dims[v]), [&](std::size_t aLayer) {
+            glm::ivec3 node;
+            node[v] = static_cast<int>(aLayer);
+            const double pv = double(aLayer);
+
+            for (std::uint32_t t : buckets[aLayer])
+            {
+                const Triangle& triangle = triangles[t];
+                const auto rangeU = nodeRange(
+                    std::min(triangle.a[u], std::min(triangle.b[u], triangle.c[u])),
+                    std::max(triangle.a[u], std::max(triangle.b[u], triangle.c[u])), 0, dims[u]);
+                for (int row = rangeU[0]; row <= rangeU[1]; ++row)
+                {
+                    // Barycentric weights in the (u, v) plane, relative to the ray
+                    const double pu = double(row);
+                    const double au = triangle.a[u] - pu, av = triangle.a[v] - pv;
+                    const double bu = triangle.b[u] - pu, bv = triangle.b[v] - pv;
+                    const double cu = triangle.c[u] - pu, cv = triangle.c[v] - pv;
+                    double wa, wb, wc;
+                    const int signA = orientation(bu, bv, cu, cv, wa);
+                    const int signB = orientation(cu, cv, au, av, wb);
+                    const int signC = orientation(au, av, bu, bv, wc);
+                    if (signA == 0 || signA != signB || signB != signC || wa + wb + wc == 0.0)
+                    {
+                        continue;
+                    }
+                    const double hit = (wa * triangle.a[axis] + wb * triangle.b[axis] + wc * triangle.c[axis]) / (wa + wb + wc);
+                    // The crossing flips the parity of every node past it
+                    const int first = std::max(0, int(std::ceil(hit)));
+                    if (first < dims[axis])
+                    {
+                        node[u] = row;
+                        node[axis] = first;
+                        crossings[field.index(node.x, node.y, node.z)] ^= 1;
+                    }
+                }
+            }
+
+            for (int row = 0; row < dims[u]; ++row)
+            {
+                node[u] = row;
+                std::uint8_t parity = 0;
+                for (int step = 0; step < dims[axis]; ++step)
+                {
+                    node[axis] = step;
+                    const std::size_t n = field.index(node.x, node.y, node.z);
+                    parity ^= crossings[n];
+                    insideVotes[n] += parity;
+                }
+            }
+        });
+    }
+
+    field.mDistances.resize(nodeCount);
+    for (std::size_t n = 0; n < nodeCount; ++n)
+    {
+        const float distance = distances[n] * field.mCellSize;
+        field.mDistances[n] = insideVotes[n] >= 2 ? -distance : distance;
+    }
+    return field;
+}
+
+std::uint64_t MeshDistanceField::sourceKey(const ObjMesh& aMesh, const MeshDistanceFieldSettings& aSettings)
+{
+    std::uint64_t hash = 1469598103934665603ull;
+    for (const VertexNormTex& vertex : aMesh.vertices)
+    {
+        hash = fnv1a(hash, &vertex.position, sizeof(vertex.position));
+    }
+    hash = fnv1a(hash, aMesh.indices.data(), aMesh.indices.size() * sizeof(unsigned int));
+    const std::uint64_t settings[2] = { aSettings.resolution, aSettings.padding };
+    return fnv1a(hash, settings, sizeof(settings));
+}
+
+bool MeshDistanceField::save(const std::filesystem::path& aPath, std::uint64_t aSourceKey) const
+{
+    std::ofstream file(aPath, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    CacheHeader header{};
+    std::memcpy(header.magic, cCacheMagic, sizeof(cCacheMagic));
+    header.sourceKey = aSourceKey;
+    for (int i = 0; i < 3; ++i)
+    {
+        header.dimensions[i] = mDimensions[i];
+        header.origin[i] = mOrigin[i];
+    }
+    header.cellSize = mCellSize;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mDistances.data()), std::streamsize(mDistances.size() * sizeof(float)));
+    return bool(file);
+}
+
+std::optional<MeshDistanceField> MeshDistanceField::load(const std::filesystem::path& aPath, std::uint64_t aSourceKey)
+{
+    std::ifstream file(aPath, std::ios::binary);
+    CacheHeader header{};
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, cCacheMagic, sizeof(cCacheMagic)) != 0
+        || header.sourceKey != aSourceKey)
+    {
+        return std::nullopt;
+    }
+
+    MeshDistanceField field;
+    field.mDimensions = glm::uvec3(header.dimensions[0], header.dimensions[1], header.dimensions[2]);
+    field.mOrigin = glm::vec3(header.origin[0], header.origin[1], header.origin[2]);
+    field.mCellSize = header.cellSize;
+    if (glm::any(glm::lessThan(field.mDimensions, glm::uvec3(2))))
+    {
+        return std::nullopt;
+    }
+    field.mDistances.resize(std::size_t(field.mDimensions.x) * field.mDimensions.y * field.mDimensions.z);
+    if (!file.read(reinterpret_cast<char*>(field.mDistances.data()), std::streamsize(field.mDistances.size() * sizeof(float))))
+    {
+        return std::nullopt;
+    }
+    return field;
+}
+
+MeshDistanceField MeshDistanceField::bakeCached(const ObjMesh& aMesh, const MeshDistanceFieldSettings& aSettings, const std::filesystem::path& aCachePath, WorkerPool& aPool)
+{
+    const std::uint64_t key = sourceKey(aMesh, aSettings);
+    if (std::optional<MeshDistanceField> cached = load(aCachePath, key))
+    {
+        return std::move(*cached);
+    }
+    MeshDistanceField field = bake(aMesh, aSettings, aPool);
+    // A read-only data directory only costs a bake per start
+    field.save(aCachePath, key);
+    return field;
+}
+
+float MeshDistanceField::distance(glm::vec3 aPosition) const
+{
+    glm::vec3 gradient;
+    return distance(aPosition, gradient);
+}
+
+float MeshDistanceField::distance(glm::vec3 aPosition, glm::vec3& aGradient) const
+{
+    const glm::vec3 grid = (aPosition - mOrigin) / mCellSize;
+    const glm::vec3 clamped = glm::clamp(grid, glm::vec3(0.0f), glm::vec3(mDimensions - glm::uvec3(1)));
+    const glm::uvec3 base = glm::min(glm::uvec3(clamped), mDimensions - glm::uvec3(2));
+    const glm::vec3 t = clamped - glm::vec3(base);
+
+    const std::size_t n000 = index(base.x, base.y, base.z);
+    const std::size_t strideY = mDimensions.x;
+    const std::size_t strideZ = std::size_t(mDimensions.x) * mDimensions.y;
+    const float d000 = mDistances[n000];
+    const float d100 = mDistances[n000 + 1];
+    const float d010 = mDistances[n000 + strideY];
+    const float d110 = mDistances[n000 + strideY + 1];
+    const float d001 = mDistances[n000 + strideZ];
+    const float d101 = mDistances[n000 + strideZ + 1];
+    const float d011 = mDistances[n000 + strideZ + strideY];
+    const float d111 = mDistances[n000 + strideZ + strideY + 1];
+
+    const float x00 = d000 + (d100 - d000) * t.x;
+    const float x10 = d010 + (d110 - d010) * t.x;
+    const float x01 = d001 + (d101 - d001) * t.x;
+    const float x11 = d011 + (d111 - d011) * t.x;
+    const float y0 = x00 + (x10 - x00) * t.y;
+    const float y1 = x01 + (x11 - x01) * t.y;
+
+    const float gradientX = glm::mix(
+        glm::mix(d100 - d000, d110 - d010, t.y),
+        glm::mix(d101 - d001, d111 - d011, t.y), t.z);
+    const float gradientY = glm::mix(x10 - x00, x11 - x01, t.z);
+    aGradient = glm::vec3(gradientX, gradientY, y1 - y0) / mCellSize;
+
+    return y0 + (y1 - y0) * t.z + glm::length(grid - clamped) * mCellSize;
+}
+
+void ParticleCollisionParams::setTransform(const glm::mat4& aFieldToSimulation)
+{
+    toField = glm::inverse(aFieldToSimulation);
+    fieldToSimulation = glm::mat3(aFieldToSimulation);
+    fieldScale = glm::length(glm::vec3(aFieldToSimulation[0]));
+}
+
+void applyParticleCollision(ParticleStorage& aStorage, const ParticleCollisionParams& aParams, float aDt, std::size_t aBegin, std::size_t aEnd)
+{
+    if (!aParams.field)
+    {
+        return;
+    }
+    for (std::size_t i = aBegin; i < aEnd; ++i)
+    {
+        if (aStorage.life[i] <= 0.0f)
+        {
+            continue;
+        }
+        const glm::vec3 position(aStorage.positionX[i], aStorage.positionY[i], aStorage.positionZ[i]);
+        glm::vec3 velocity(aStorage.velocityX[i], aStorage.velocityY[i], aStorage.velocityZ[i]);
+        collideParticle(aParams, position, velocity, aDt);
+        aStorage.velocityX[i] = velocity.x;
+        aStorage.velocityY[i] = velocity.y;
+        aStorage.velocityZ[i] = velocity.z;
+    }
+}
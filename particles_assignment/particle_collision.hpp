@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "obj_file_loading.hpp"
+#include "particle_storage.hpp"
+#include "worker_pool.hpp"
+
+struct MeshDistanceFieldSettings
+{
+    // Grid cells along the longest side of the mesh bounds
+    std::size_t resolution = 64;
+    // Extra cells around the bounds, so particles feel the mesh before they touch it
+    std::size_t padding = 3;
+};
+
+/**
+ * @brief Signed distance to a triangle mesh, sampled on a dense grid.
+ *
+ * Distances are stored at the grid nodes, in mesh units, negative inside.
+ * bake() computes exact distances near the triangles, propagates the closest
+ * triangle to the rest of the grid with fast sweeping, and decides inside
+ * and outside by a majority vote of ray parity along x, y and z, which
+ * tolerates small holes in the mesh.
+ */
+class MeshDistanceField
+{
+public:
+    MeshDistanceField() = default;
+
+    static MeshDistanceField bake(const ObjMesh& aMesh, const MeshDistanceFieldSettings& aSettings, WorkerPool& aPool);
+    // Loads aCachePath if it was baked from the same mesh and settings,
+    // otherwise bakes and tries to write the cache.
+    static MeshDistanceField bakeCached(const ObjMesh& aMesh, const MeshDistanceFieldSettings& aSettings, const std::filesystem::path& aCachePath, WorkerPool& aPool);
+
+    // Returns false if the file could not be written
+    bool save(const std::filesystem::path& aPath, std::uint64_t aSourceKey) const;
+    // Empty if the file is missing, damaged or has another source key
+    static std::optional<MeshDistanceField> load(const std::filesystem::path& aPath, std::uint64_t aSourceKey);
+    // Identifies the mesh and settings a field was baked from
+    static std::uint64_t sourceKey(const ObjMesh& aMesh, const MeshDistanceFieldSettings& aSettings);
+
+    // Trilinear distance at aPosition in mesh units. Outside the grid the
+    // distance to the grid is added, so far points stay far.
+    float distance(glm::vec3 aPosition) const;
+    // Same, also returns the gradient of the trilinear interpolation
+    float distance(glm::vec3 aPosition, glm::vec3& aGradient) const;
+
+    glm::uvec3 dimensions() const { return mDimensions; }
+    glm::vec3 origin() const { return mOrigin; }
+    float cellSize() const { return mCellSize; }
+    const std::vector<float>& distances() const { return mDistances; }
+
+private:
+    std::size_t index(std::size_t aX, std::size_t aY, std::size_t aZ) const
+    {
+        return (aZ * mDimensions.y + aY) * mDimensions.x + aX;
+    }
+
+    glm::uvec3 mDimensions = glm::uvec3(0);
+    glm::vec3 mOrigin = glm::vec3(0.0f);
+    float mCellSize = 1.0f;
+    std::vector<float> mDistances;
+};
+
+struct ParticleCollisionParams
+{
+    // Not owned; null disables the affector
+    const MeshDistanceField* field = nullptr;
+    // Simulation space to mesh space, and back for normals. The transform
+    // may rotate, translate and scale uniformly.
+    glm::mat4 toField = glm::mat4(1.0f);
+    glm::mat3 fieldToSimulation = glm::mat3(1.0f);
+    // Simulation units per mesh unit
+    float fieldScale = 1.0f;
+
+    // Particles are treated as spheres of this radius
+    float radius = 0.02f;
+    // Share of the normal speed kept after a bounce; 0 slides along the surface
+    float restitution = 0.3f;
+    // Share of the tangential speed lost per contact
+    float friction = 0.1f;
+
+    // aFieldToSimulation maps mesh coordinates into the simulation space,
+    // e.g. inverse(particle model matrix) * mesh model matrix
+    void setTransform(const glm::mat4& aFieldToSimulation);
+};
+
+// Bounces or slides a particle off the field surface, if the step would take
+// it closer than the radius. Also pushes particles that are already inside
+// back out. One trilinear lookup per particle.
+inline void collideParticle(const ParticleCollisionParams& aParams, glm::vec3 aPosition, glm::vec3& aVelocity, float aDt)
+{
+    const glm::vec3 next = aPosition + aVelocity * aDt;
+    glm::vec3 gradient;
+    const float distance = aParams.field->distance(glm::vec3(aParams.toField * glm::vec4(next, 1.0f)), gradient);
+    const float penetration = aParams.radius - distance * aParams.fieldScale;
+    if (penetration <= 0.0f)
+    {
+        return;
+    }
+    const glm::vec3 direction = aParams.fieldToSimulation * gradient;
+    const float length = glm::length(direction);
+    if (length < 1e-12f || aDt <= 0.0f)
+    {
+        return;
+    }
+    const glm::vec3 normal = direction / length;
+
+    const float normalSpeed = glm::dot(aVelocity, normal);
+    if (normalSpeed < 0.0f)
+    {
+        const glm::vec3 tangential = aVelocity - normalSpeed * normal;
+        aVelocity = tangential * (1.0f - aParams.friction) - aParams.restitution * normalSpeed * normal;
+    }
+    aVelocity += normal * (penetration / aDt);
+}
+
+// Applies collideParticle() to the live particles in [aBegin, aEnd)
+void applyParticleCollision(ParticleStorage& aStorage, const ParticleCollisionParams& aParams, float aDt, std::size_t aBegin, std::size_t aEnd);
@@ -0,0 +1,122 @@
+#include "particle_curves.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+template<typename TKey, typename TValue, typename TGetValue>
+TValue evaluateKeys(const std::vector<TKey>& aKeys, float aAge, TGetValue aGetValue)
+{
+    if (aAge <= aKeys.front().age)
+    {
+        return aGetValue(aKeys.front());
+    }
+    for (std::size_t k = 1; k < aKeys.size(); ++k)
+    {
+        if (aAge <= aKeys[k].age)
+        {
+            const float span = aKeys[k].age - aKeys[k - 1].age;
+            const float t = span > 0.0f ? (aAge - aKeys[k - 1].age) / span : 1.0f;
+            return glm::mix(aGetValue(aKeys[k - 1]), aGetValue(aKeys[k]), t);
+        }
+    }
+    return aGetValue(aKeys.back());
+}
+
+template<typename TKey>
+void sortKeys(std::vector<TKey>& aKeys)
+{
+    for (TKey& key : aKeys)
+    {
+        key.age = std::clamp(key.age, 0.0f, 1.0f);
+    }
+    std::stable_sort(aKeys.begin(), aKeys.end(), [](const TKey& aLeft, const TKey& aRight) { return aLeft.age < aRight.age; });
+}
+
+float sampleAge(std::size_t aSample)
+{
+    return float(aSample) / float(cParticleCurveSamples - 1);
+}
+
+// Position between two samples, like in particle.vertex.glsl
+void samplePosition(float aAge, std::size_t& aIndex, float& aFraction)
+{
+    const float x = std::clamp(aAge, 0.0f, 1.0f) * float(cParticleCurveSamples - 1);
+    aIndex = std::min(static_cast<std::size_t>(x), cParticleCurveSamples - 2);
+    aFraction = x - float(aIndex);
+}
+
+} // namespace
+
+ParticleLifeCurves::ParticleLifeCurves()
+{
+    setColorKeys(fireGradient());
+    setSizeKeys({ { 0.0f, 1.0f } });
+}
+
+std::vector<ParticleColorKey> ParticleLifeCurves::fireGradient()
+{
+    // The former per-particle gradient, with age = 1 - life / initial life.
+    // Its alpha was 1 - age less a fade of alphaDecay (2.5) times the 1/60 s
+    // step, so it reached zero at age 23/24.
+    constexpr float fade = 2.5f / 60.0f;
+    constexpr float fadeOut = 1.0f - fade;
+    const glm::vec3 orange(1.0f, 0.5f, 0.0f);
+    const glm::vec3 red(1.0f, 0.1f, 0.0f);
+    return {
+        { 0.0f, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f - fade) },
+        { 0.25f, glm::vec4(1.0f, 1.0f, 0.0f, 0.75f - fade) },
+        { 0.5f, glm::vec4(orange, 0.5f - fade) },
+        { fadeOut, glm::vec4(glm::mix(orange, red, (fadeOut - 0.5f) / 0.5f), 0.0f) },
+        { 1.0f, glm::vec4(red, 0.0f) },
+    };
+}
+
+void ParticleLifeCurves::setColorKeys(std::vector<ParticleColorKey> aKeys)
+{
+    if (aKeys.empty())
+    {
+        return;
+    }
+    sortKeys(aKeys);
+    for (std::size_t s = 0; s < cParticleCurveSamples; ++s)
+    {
+        const glm::vec4 color = evaluateKeys<ParticleColorKey, glm::vec4>(aKeys, sampleAge(s), [](const ParticleColorKey& aKey) { return aKey.color; });
+        for (int c = 0; c < 4; ++c)
+        {
+            mColorSamples[4 * s + c] = color[c];
+        }
+    }
+}
+
+void ParticleLifeCurves::setSizeKeys(std::vector<ParticleSizeKey> aKeys)
+{
+    if (aKeys.empty())
+    {
+        return;
+    }
+    sortKeys(aKeys);
+    for (std::size_t s = 0; s < cParticleCurveSamples; ++s)
+    {
+        mSizeSamples[s] = evaluateKeys<ParticleSizeKey, float>(aKeys, sampleAge(s), [](const ParticleSizeKey& aKey) { return aKey.size; });
+    }
+}
+
+glm::vec4 ParticleLifeCurves::color(float aAge) const
+{
+    std::size_t index;
+    float fraction;
+    samplePosition(aAge, index, fraction);
+    const glm::vec4 from(mColorSamples[4 * index], mColorSamples[4 * index + 1], mColorSamples[4 * index + 2], mColorSamples[4 * index + 3]);
+    const glm::vec4 to(mColorSamples[4 * index + 4], mColorSamples[4 * index + 5], mColorSamples[4 * index + 6], mColorSamples[4 * index + 7]);
+    return glm::mix(from, to, fraction);
+}
+
+float ParticleLifeCurves::size(float aAge) const
+{
+    std::size_t index;
+    float fraction;
+    samplePosition(aAge, index, fraction);
+    return glm::mix(mSizeSamples[index], mSizeSamples[index + 1], fraction);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Samples per baked curve. Keys at multiples of 1/16 are reproduced exactly.
+constexpr std::size_t cParticleCurveSamples = 17;
+
+struct ParticleColorKey
+{
+    float age;
+    glm::vec4 color;
+};
+
+struct ParticleSizeKey
+{
+    float age;
+    float size;
+};
+
+/**
+ * @brief Color and size over the life of a particle.
+ *
+ * Both curves are piecewise linear over the normalized age (0 at spawn,
+ * 1 at death) and are baked into cParticleCurveSamples samples. The samples
+ * are uploaded as uniform arrays and interpolated by particle.vertex.glsl,
+ * so the simulation only keeps the life of each particle.
+ */
+class ParticleLifeCurves
+{
+public:
+    // White -> yellow -> orange -> red with a linear fade, constant size;
+    // see fireGradient()
+    ParticleLifeCurves();
+
+    // Keys are sorted by age; ages outside [0, 1] are clamped. An empty
+    // list keeps the current curve.
+    void setColorKeys(std::vector<ParticleColorKey> aKeys);
+    void setSizeKeys(std::vector<ParticleSizeKey> aKeys);
+
+    // Same interpolation of the samples as the vertex shader
+    glm::vec4 color(float aAge) const;
+    float size(float aAge) const;
+
+    // RGBA per sample, for a float[4 * cParticleCurveSamples] uniform
+    const std::array<float, 4 * cParticleCurveSamples>& colorSamples() const { return mColorSamples; }
+    const std::array<float, cParticleCurveSamples>& sizeSamples() const { return mSizeSamples; }
+
+    // The fire's colors before curves existed, including the alpha fade of
+    // the old update. The zero crossing at age 23/24 falls between two
+    // samples, so alpha there is less than 0.02 off.
+    static std::vector<ParticleColorKey> fireGradient();
+
+private:
+    std::array<float, 4 * cParticleCurveSamples> mColorSamples;
+    std::array<float, cParticleCurveSamples> mSizeSamples;
+};
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <glm/glm.hpp>
+
+#include "counter_rng.hpp"
+#include "particle_collision.hpp"
+#include "particle_mesh_surface.hpp"
+#include "particle_simulation.hpp"
+#include "particle_turbulence.hpp"
+
+// Building blocks of a ParticleEffect. Each policy is a small aggregate with
+// its settings as members; which policies an effect uses is fixed by its
+// type, so the compiler inlines all of them into one loop per effect type.
+//
+// Every policy draws a fixed number of random values, so the draws of one
+// particle never depend on the values drawn before.
+
+// Spawn shapes: offset of a new particle from the emitter
+
+struct PointShape
+{
+    glm::vec3 sample(CounterRandom&) const { return glm::vec3(0.0f); }
+};
+
+// Three draws, uniform in the box [-halfExtent, halfExtent]
+struct BoxShape
+{
+    glm::vec3 halfExtent = glm::vec3(0.5f);
+
+    glm::vec3 sample(CounterRandom& aRandom) const
+    {
+        const float x = aRandom.nextSigned();
+        const float y = aRandom.nextSigned();
+        const float z = aRandom.nextSigned();
+        return 2.0f * halfExtent * glm::vec3(x, y, z);
+    }
+};
+
+// Three draws: a disc in the xy plane, denser towards the center, and a
+// spread along z. The original fire emitter.
+struct DiscShape
+{
+    float radius = 0.25f;
+    float depth = 0.5f;
+
+    glm::vec3 sample(CounterRandom& aRandom) const
+    {
+        const float angle = aRandom.nextSigned() * 2.0f * 3.14159f;
+        const float distance = aRandom.nextSigned() * (2.0f * radius);
+        const float z = aRandom.nextSigned() * depth;
+        return glm::vec3(distance * std::cos(angle), distance * std::sin(angle), z);
+    }
+};
+
+// Three draws, uniform over the surface area of a mesh, see
+// MeshSurfaceSampler. transform places the mesh relative to the emitter,
+// e.g. its model matrix for an emitter at the origin. The sampler must be set.
+struct MeshSurfaceShape
+{
+    std::shared_ptr<const MeshSurfaceSampler> sampler;
+    glm::mat4 transform = glm::mat4(1.0f);
+
+    glm::vec3 sample(CounterRandom& aRandom) const
+    {
+        return glm::vec3(transform * glm::vec4(sampler->sample(aRandom), 1.0f));
+    }
+};
+
+// Initial velocities, given the spawn offset
+
+// Three draws, base plus up to half the spread in each direction
+struct JitteredVelocity
+{
+    glm::vec3 base = glm::vec3(0.0f);
+    glm::vec3 spread = glm::vec3(0.0f);
+
+    glm::vec3 sample(CounterRandom& aRandom, glm::vec3) const
+    {
+        const float x = aRandom.nextSigned();
+        const float y = aRandom.nextSigned();
+        const float z = aRandom.nextSigned();
+        return base + glm::vec3(x, y, z) * spread;
+    }
+};
+
+// One draw, away from the emitter; particles spawned at the emitter go up
+struct RadialVelocity
+{
+    float speed = 1.0f;
+    float spread = 0.0f;
+
+    glm::vec3 sample(CounterRandom& aRandom, glm::vec3 aOffset) const
+    {
+        const float length = glm::length(aOffset);
+        const glm::vec3 direction = length > 0.0f ? aOffset / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        return direction * (speed + aRandom.nextSigned() * spread);
+    }
+};
+
+// Initial life in seconds times the life decay; one draw
+struct RandomLifetime
+{
+    float mean = 1.0f;
+    float spread = 0.0f;
+
+    float sample(CounterRandom& aRandom) const { return mean + aRandom.nextSigned() * spread; }
+    // Upper bound of sample(), see ParticleSimulation::setEffect()
+    float maxLife() const { return mean + std::abs(spread); }
+};
+
+// Render attributes: quad scale and tint, see ParticleInstance. The quad
+// edge is proportional to the scale; the fire's 0.05 draws it at
+// ParticleSystem::getParticleSize(). Color and size over life are applied on
+// top by the vertex shader.
+
+// One draw for the scale, constant tint
+struct SizeAndTint
+{
+    float size = 0.05f;
+    float sizeSpread = 0.0f;
+    glm::vec4 tint = glm::vec4(1.0f);
+
+    // Upper bound of the scale, see ParticleSimulation::setEffect()
+    float maxSize() const { return size + std::abs(sizeSpread); }
+
+    void apply(ParticleStorage& aStorage, std::size_t aIndex, CounterRandom& aRandom) const
+    {
+        aStorage.scale[aIndex] = size + aRandom.nextSigned() * sizeSpread;
+        aStorage.colorR[aIndex] = tint.r;
+        aStorage.colorG[aIndex] = tint.g;
+        aStorage.colorB[aIndex] = tint.b;
+        aStorage.colorA[aIndex] = tint.a;
+    }
+};
+
+// Two draws, the tint is picked between two colors
+struct SizeAndTintRange
+{
+    float size = 0.05f;
+    float sizeSpread = 0.0f;
+    glm::vec4 tintFrom = glm::vec4(1.0f);
+    glm::vec4 tintTo = glm::vec4(1.0f);
+
+    float maxSize() const { return size + std::abs(sizeSpread); }
+
+    void apply(ParticleStorage& aStorage, std::size_t aIndex, CounterRandom& aRandom) const
+    {
+        aStorage.scale[aIndex] = size + aRandom.nextSigned() * sizeSpread;
+        const glm::vec4 tint = glm::mix(tintFrom, tintTo, aRandom.nextFloat());
+        aStorage.colorR[aIndex] = tint.r;
+        aStorage.colorG[aIndex] = tint.g;
+        aStorage.colorB[aIndex] = tint.b;
+        aStorage.colorA[aIndex] = tint.a;
+    }
+};
+
+// Affectors change the velocity of a live particle before it is integrated
+
+struct ConstantAcceleration
+{
+    glm::vec3 acceleration = glm::vec3(0.0f, -9.81f, 0.0f);
+
+    void apply(glm::vec3, glm::vec3& aVelocity, float aDt) const { aVelocity += acceleration * aDt; }
+};
+
+// Exponential-style slow down, clamped so large steps never reverse the velocity
+struct LinearDrag
+{
+    float coefficient = 1.0f;
+
+    void apply(glm::vec3, glm::vec3& aVelocity, float aDt) const
+    {
+        aVelocity *= std::max(0.0f, 1.0f - coefficient * aDt);
+    }
+};
+
+// Pulls towards a point with constant strength
+struct PointAttractor
+{
+    glm::vec3 center = glm::vec3(0.0f);
+    float strength = 1.0f;
+
+    void apply(glm::vec3 aPosition, glm::vec3& aVelocity, float aDt) const
+    {
+        const glm::vec3 toCenter = center - aPosition;
+        const float distance = glm::length(toCenter);
+        if (distance > 1e-6f)
+        {
+            aVelocity += toCenter * (strength * aDt / distance);
+        }
+    }
+};
+
+// Curl-noise turbulence, see CurlNoiseField. The field must be set.
+struct CurlNoiseTurbulence
+{
+    const CurlNoiseField* field = nullptr;
+    float strength = 1.0f;
+    float frequency = 0.5f;
+
+    void apply(glm::vec3 aPosition, glm::vec3& aVelocity, float aDt) const
+    {
+        aVelocity += field->sample(aPosition * frequency) * (strength * aDt);
+    }
+};
+
+// Bounces off a baked mesh, see collideParticle(). The field must be set.
+// List it last, so it sees the velocity the other affectors produced.
+struct MeshCollision
+{
+    ParticleCollisionParams params;
+
+    void apply(glm::vec3 aPosition, glm::vec3& aVelocity, float aDt) const
+    {
+        collideParticle(params, aPosition, aVelocity, aDt);
+    }
+};
+
+/**
+ * @brief Spawns particles from a shape, an initial velocity, a lifetime and render attributes.
+ *
+ * The policies draw their random values in this order, so two spawners with
+ * the same policy types and settings produce identical particles.
+ */
+template <class Shape, class Velocity, class Lifetime, class Appearance>
+struct ParticleSpawner
+{
+    Shape shape;
+    Velocity velocity;
+    Lifetime lifetime;
+    Appearance appearance;
+
+    void spawn(ParticleStorage& aStorage, std::size_t aIndex, glm::vec3 aEmitterPos, CounterRandom& aRandom) const
+    {
+        const glm::vec3 offset = shape.sample(aRandom);
+        const glm::vec3 initialVelocity = velocity.sample(aRandom, offset);
+        const float initialLife = lifetime.sample(aRandom);
+
+        aStorage.positionX[aIndex] = aEmitterPos.x + offset.x;
+        aStorage.positionY[aIndex] = aEmitterPos.y + offset.y;
+        aStorage.positionZ[aIndex] = aEmitterPos.z + offset.z;
+        aStorage.velocityX[aIndex] = initialVelocity.x;
+        aStorage.velocityY[aIndex] = initialVelocity.y;
+        aStorage.velocityZ[aIndex] = initialVelocity.z;
+        aStorage.initialLife[aIndex] = aStorage.life[aIndex] = initialLife;
+        appearance.apply(aStorage, aIndex, aRandom);
+    }
+};
+
+// The spawner behind respawnParticle(), mirrored by particle_emit.compute.glsl
+using FireParticleSpawner = ParticleSpawner<DiscShape, JitteredVelocity, RandomLifetime, SizeAndTint>;
+
+inline FireParticleSpawner fireParticleSpawner()
+{
+    FireParticleSpawner spawner;
+    spawner.shape = DiscShape{ 0.25f, 0.5f };
+    spawner.velocity = JitteredVelocity{ glm::vec3(0.0f, 1.8f, 0.0f), glm::vec3(0.2f, 0.7f, 0.4f) };
+    spawner.lifetime = RandomLifetime{ 1.0f, 0.7f };
+    spawner.appearance = SizeAndTint{ 0.05f, 0.02f, glm::vec4(1.0f) };
+    return spawner;
+}
+
+/**
+ * @brief A spawner and a list of affectors, composed at compile time.
+ *
+ * step() has the same phases as simulateParticles(): emission, one fused
+ * update loop over the live particles and compaction. The update applies
+ * every affector in order, then integrates position and life; there are no
+ * virtual calls and no per-particle checks of which affectors are enabled.
+ * The result is bit-identical for any thread count.
+ *
+ * Affectors change the velocity before the position step (semi-implicit
+ * Euler), unlike updateParticles(), which applies ParticleUpdateParams
+ * acceleration after it. Separation and ParticleStepParams::turbulence are
+ * not used; CurlNoiseTurbulence is the affector form of the latter.
+ */
+template <class Spawner, class... Affectors>
+class ParticleEffect
+{
+public:
+    explicit ParticleEffect(Spawner aSpawner = Spawner(), Affectors... aAffectors)
+        : mSpawner(std::move(aSpawner))
+        , mAffectors(std::move(aAffectors)...)
+    {}
+
+    Spawner& spawner() { return mSpawner; }
+    const Spawner& spawner() const { return mSpawner; }
+
+    template <std::size_t tIndex>
+    auto& affector() { return std::get<tIndex>(mAffectors); }
+    template <std::size_t tIndex>
+    const auto& affector() const { return std::get<tIndex>(mAffectors); }
+
+    std::size_t emit(ParticleStorage& aStorage, std::size_t aCount, const ParticleStepParams& aParams, WorkerPool& aPool) const
+    {
+        return emitParticles(aStorage, aCount, aParams, aPool,
+            [this](ParticleStorage& aTarget, std::size_t aIndex, glm::vec3 aEmitterPos, CounterRandom& aRandom) {
+                mSpawner.spawn(aTarget, aIndex, aEmitterPos, aRandom);
+            });
+    }
+
+    // Applies the affectors to the live particles in [aBegin, aEnd) and integrates them
+    void update(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::size_t aBegin, std::size_t aEnd) const
+    {
+        const float dt = aParams.dt;
+        const float lifeStep = aParams.lifeDecay * dt;
+        for (std::size_t i = aBegin; i < aEnd; ++i)
+        {
+            const float life = aStorage.life[i];
+            if (life <= 0.0f)
+            {
+                continue;
+            }
+            glm::vec3 position(aStorage.positionX[i], aStorage.positionY[i], aStorage.positionZ[i]);
+            glm::vec3 velocity(aStorage.velocityX[i], aStorage.velocityY[i], aStorage.velocityZ[i]);
+            std::apply([&](const Affectors&... aAffector) { (aAffector.apply(position, velocity, dt), ...); }, mAffectors);
+            position += velocity * dt;
+
+            aStorage.positionX[i] = position.x;
+            aStorage.positionY[i] = position.y;
+            aStorage.positionZ[i] = position.z;
+            aStorage.velocityX[i] = velocity.x;
+            aStorage.velocityY[i] = velocity.y;
+            aStorage.velocityZ[i] = velocity.z;
+            aStorage.life[i] = life - lifeStep;
+        }
+    }
+
+    // Emission, update and compaction of one step; returns the live count
+    unsigned int step(ParticleStorage& aStorage, const ParticleStepParams& aParams, std::size_t aEmitCount, WorkerPool& aPool) const
+    {
+        emit(aStorage, aEmitCount, aParams, aPool);
+
+        const std::size_t alive = aStorage.aliveCount;
+        aPool.parallelFor(particleChunkCount(alive), [&](std::size_t aChunk) {
+            const std::size_t begin = aChunk * cParticleChunkSize;
+            const std::size_t end = std::min(alive, begin + cParticleChunkSize);
+            storePreviousPositions(aStorage, begin, end);
+            update(aStorage, aParams.update, begin, end);
+        });
+
+        compactParticles(aStorage);
+        return static_cast<unsigned int>(aStorage.aliveCount);
+    }
+
+private:
+    Spawner mSpawner;
+    std::tuple<Affectors...> mAffectors;
+};
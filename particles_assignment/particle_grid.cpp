@@ -0,0 +1,116 @@
+#include "particle_grid.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include "particle_simulation.hpp"
+
+void ParticleGrid::build(const ParticleStorage& aStorage, float aCellSize)
+{
+    const std::size_t alive = aStorage.aliveCount;
+    mCellSize = aCellSize;
+    mInverseCellSize = 1.0f / aCellSize;
+
+    // Four table slots per particle: with two, cells of other regions
+    // sharing a slot were most of the candidates of sparse particles
+    const std::size_t tableSize = std::max<std::size_t>(1024, std::bit_ceil(alive * 4));
+    mTableMask = static_cast<std::uint32_t>(tableSize - 1);
+
+    mParticleSlots.resize(alive);
+    mCellStart.assign(tableSize + 1, 0);
+    for (std::size_t i = 0; i < alive; ++i)
+    {
+        const std::uint32_t slot = cellHash(
+            cellCoordinate(aStorage.positionX[i]),
+            cellCoordinate(aStorage.positionY[i]),
+            cellCoordinate(aStorage.positionZ[i]));
+        mParticleSlots[i] = slot;
+        ++mCellStart[slot + 1];
+    }
+
+    for (std::size_t slot = 0; slot < tableSize; ++slot)
+    {
+        mCellStart[slot + 1] += mCellStart[slot];
+    }
+
+    // Stable scatter: within a cell, particles stay in slot order
+    mSortedIndices.resize(alive);
+    mSortedX.resize(alive);
+    mSortedY.resize(alive);
+    mSortedZ.resize(alive);
+    std::vector<std::uint32_t> cursor(mCellStart.begin(), mCellStart.end() - 1);
+    for (std::size_t i = 0; i < alive; ++i)
+    {
+        const std::uint32_t k = cursor[mParticleSlots[i]]++;
+        mSortedIndices[k] = static_cast<std::uint32_t>(i);
+        mSortedX[k] = aStorage.positionX[i];
+        mSortedY[k] = aStorage.positionY[i];
+        mSortedZ[k] = aStorage.positionZ[i];
+    }
+}
+
+void applyParticleSeparation(ParticleStorage& aStorage, const ParticleGrid& aGrid, const ParticleSeparationParams& aParams, float aDt, WorkerPool& aPool)
+{
+    const float radius = aParams.radius;
+    const float radiusSquared = radius * radius;
+    const float impulse = aParams.strength * aDt;
+    const std::size_t count = aGrid.size();
+
+    // Particles are visited in cell order, so the neighborhood is only
+    // looked up when the cell changes. Each particle only writes its own
+    // velocity.
+    aPool.parallelFor(particleChunkCount(count), [&](std::size_t aChunk) {
+        ParticleGrid::Neighborhood ranges;
+        std::size_t rangeCount = 0;
+        std::array<int, 3> currentCell = {};
+
+        const std::size_t begin = aChunk * cParticleChunkSize;
+        const std::size_t end = std::min(count, begin + cParticleChunkSize);
+        for (std::size_t k = begin; k < end; ++k)
+        {
+            const float x = aGrid.sortedX(k);
+            const float y = aGrid.sortedY(k);
+            const float z = aGrid.sortedZ(k);
+
+            const std::array<int, 3> cell = aGrid.cellOf(x, y, z);
+            if (k == begin || cell != currentCell)
+            {
+                currentCell = cell;
+                rangeCount = aGrid.neighborhood(cell, ranges);
+            }
+
+            float pushX = 0.0f;
+            float pushY = 0.0f;
+            float pushZ = 0.0f;
+            unsigned int candidates = 0;
+            for (std::size_t r = 0; r < rangeCount && candidates < aParams.maxCandidates; ++r)
+            {
+                const std::uint32_t rangeEnd = std::min<std::uint32_t>(ranges[r].end, ranges[r].begin + (aParams.maxCandidates - candidates));
+                candidates += rangeEnd - ranges[r].begin;
+                for (std::uint32_t other = ranges[r].begin; other < rangeEnd; ++other)
+                {
+                    const float dx = x - aGrid.sortedX(other);
+                    const float dy = y - aGrid.sortedY(other);
+                    const float dz = z - aGrid.sortedZ(other);
+                    const float distanceSquared = dx * dx + dy * dy + dz * dz;
+                    // Also skips the particle itself
+                    if (distanceSquared < radiusSquared && distanceSquared > 0.0f)
+                    {
+                        // Linear falloff from full strength at contact to zero at the radius
+                        const float distance = std::sqrt(distanceSquared);
+                        const float weight = (1.0f - distance / radius) / distance;
+                        pushX += dx * weight;
+                        pushY += dy * weight;
+                        pushZ += dz * weight;
+                    }
+                }
+            }
+
+            const std::uint32_t i = aGrid.particleAt(k);
+            aStorage.velocityX[i] += pushX * impulse;
+            aStorage.velocityY[i] += pushY * impulse;
+            aStorage.velocityZ[i] += pushZ * impulse;
+        }
+    });
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "particle_storage.hpp"
+#include "worker_pool.hpp"
+
+/**
+ * @brief Uniform spatial hash grid over the live particles.
+ *
+ * Cells are hashed into a power-of-two table, so the grid is unbounded and
+ * needs no extents. build() is a counting sort over the cell keys: particle
+ * indices and positions are copied into cell order, which makes iterating
+ * one cell a linear scan. Hash collisions only add candidates, callers
+ * always check the actual distance.
+ */
+class ParticleGrid
+{
+public:
+    void build(const ParticleStorage& aStorage, float aCellSize);
+
+    std::size_t size() const { return mSortedIndices.size(); }
+    float cellSize() const { return mCellSize; }
+
+    // Particle in cell order position aSorted
+    std::uint32_t particleAt(std::size_t aSorted) const { return mSortedIndices[aSorted]; }
+    float sortedX(std::size_t aSorted) const { return mSortedX[aSorted]; }
+    float sortedY(std::size_t aSorted) const { return mSortedY[aSorted]; }
+    float sortedZ(std::size_t aSorted) const { return mSortedZ[aSorted]; }
+
+    struct CellRange
+    {
+        std::uint32_t begin;
+        std::uint32_t end;
+    };
+    // At most two ranges per row, a row can wrap around the end of the table
+    using Neighborhood = std::array<CellRange, 18>;
+
+    std::array<int, 3> cellOf(float aX, float aY, float aZ) const
+    {
+        return { cellCoordinate(aX), cellCoordinate(aY), cellCoordinate(aZ) };
+    }
+
+    // Collects the sorted ranges covering the 27 cells around aCell and
+    // returns how many there are. Each table slot is covered once, even if
+    // two cells of the neighborhood share it. Particles of one cell are
+    // contiguous, so callers walking the grid in order can reuse the result
+    // until the cell changes.
+    std::size_t neighborhood(const std::array<int, 3>& aCell, Neighborhood& aRanges) const
+    {
+        // The three cells of a row occupy consecutive slots
+        std::array<std::uint32_t, 9> rowStarts;
+        std::size_t rowCount = 0;
+        for (int dz = -1; dz <= 1; ++dz)
+        {
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                rowStarts[rowCount++] = cellHash(aCell[0] - 1, aCell[1] + dy, aCell[2] + dz);
+            }
+        }
+        // Rows less than three slots apart share slots and are walked slot
+        // by slot; with four slots per particle this is rare
+        bool overlap = false;
+        for (std::size_t i = 0; i < rowStarts.size(); ++i)
+        {
+            for (std::size_t j = i + 1; j < rowStarts.size(); ++j)
+            {
+                overlap |= ((rowStarts[j] - rowStarts[i] + 2) & mTableMask) <= 4;
+            }
+        }
+        return overlap ? overlappingNeighborhood(rowStarts, aRanges) : disjointNeighborhood(rowStarts, aRanges);
+    }
+
+    // Calls aFunc(sortedIndex) for every particle in the 27 cells around
+    // (aX, aY, aZ) until it returns false
+    template<typename TFunc>
+    void forEachCandidate(float aX, float aY, float aZ, TFunc&& aFunc) const
+    {
+        Neighborhood ranges;
+        const std::size_t rangeCount = neighborhood(cellOf(aX, aY, aZ), ranges);
+        for (std::size_t r = 0; r < rangeCount; ++r)
+        {
+            for (std::uint32_t k = ranges[r].begin; k < ranges[r].end; ++k)
+            {
+                if (!aFunc(std::size_t(k)))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+private:
+    // Common case: one range per row, two where it wraps around the table
+    std::size_t disjointNeighborhood(const std::array<std::uint32_t, 9>& aRowStarts, Neighborhood& aRanges) const
+    {
+        std::size_t rangeCount = 0;
+        for (const std::uint32_t rowStart : aRowStarts)
+        {
+            const std::uint32_t rowEnd = rowStart + 3;
+            if (rowEnd <= mTableMask + 1)
+            {
+                aRanges[rangeCount] = { mCellStart[rowStart], mCellStart[rowEnd] };
+                rangeCount += aRanges[rangeCount].end > aRanges[rangeCount].begin;
+            }
+            else
+            {
+                aRanges[rangeCount] = { mCellStart[rowStart], mCellStart[mTableMask + 1] };
+                rangeCount += aRanges[rangeCount].end > aRanges[rangeCount].begin;
+                aRanges[rangeCount] = { mCellStart[0], mCellStart[rowEnd & mTableMask] };
+                rangeCount += aRanges[rangeCount].end > aRanges[rangeCount].begin;
+            }
+        }
+        return rangeCount;
+    }
+
+    // Rows sharing slots: covers every slot once
+    std::size_t overlappingNeighborhood(const std::array<std::uint32_t, 9>& aRowStarts, Neighborhood& aRanges) const
+    {
+        std::size_t rangeCount = 0;
+        for (std::size_t row = 0; row < aRowStarts.size(); ++row)
+        {
+            const std::uint32_t rowStart = aRowStarts[row];
+            std::uint32_t rangeBegin = 0;
+            bool open = false;
+            for (std::uint32_t offset = 0; offset <= 3; ++offset)
+            {
+                const std::uint32_t slot = (rowStart + offset) & mTableMask;
+                bool take = offset < 3;
+                for (std::size_t r = 0; take && r < row; ++r)
+                {
+                    take = ((slot - aRowStarts[r]) & mTableMask) >= 3;
+                }
+                // A range also ends where the row wraps around the table
+                if (open && (!take || slot == 0))
+                {
+                    const std::uint32_t rangeEnd = mCellStart[((slot - 1) & mTableMask) + 1];
+                    if (rangeEnd > rangeBegin)
+                    {
+                        aRanges[rangeCount++] = { rangeBegin, rangeEnd };
+                    }
+                    open = false;
+                }
+                if (take && !open)
+                {
+                    rangeBegin = mCellStart[slot];
+                    open = true;
+                }
+            }
+        }
+        return rangeCount;
+    }
+
+    int cellCoordinate(float aValue) const { return static_cast<int>(std::floor(aValue * mInverseCellSize)); }
+
+    // Neighbors along x get neighboring slots, so a row of cells is one
+    // contiguous range in the sorted arrays
+    std::uint32_t cellHash(int aX, int aY, int aZ) const
+    {
+        const std::uint32_t rowHash = (std::uint32_t(aY) * 19349663u) ^ (std::uint32_t(aZ) * 83492791u);
+        return (rowHash + std::uint32_t(aX)) & mTableMask;
+    }
+
+    float mCellSize = 1.0f;
+    float mInverseCellSize = 1.0f;
+    std::uint32_t mTableMask = 0;
+
+    std::vector<std::uint32_t> mParticleSlots;
+    // mCellStart[slot] .. mCellStart[slot + 1] is the range of a table slot
+    std::vector<std::uint32_t> mCellStart;
+    std::vector<std::uint32_t> mSortedIndices;
+    std::vector<float> mSortedX;
+    std::vector<float> mSortedY;
+    std::vector<float> mSortedZ;
+};
+
+struct ParticleSeparationParams
+{
+    // Interaction radius, also the grid cell size. 0 disables the affector.
+    float radius = 0.0f;
+    // Velocity change per second between two touching particles
+    float strength = 0.0f;
+    // Candidates examined per particle, bounds the cost in dense regions
+    // such as the spawn volume
+    unsigned int maxCandidates = 64;
+};
+
+// Pushes overlapping particles apart by changing their velocity. Linear in
+// the live count for a bounded neighbor count; the result does not depend on
+// the number of threads.
+void applyParticleSeparation(ParticleStorage& aStorage, const ParticleGrid& aGrid, const ParticleSeparationParams& aParams, float aDt, WorkerPool& aPool);
@@ -0,0 +1,339 @@
+#include "particle_kernels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+    #define PARTICLE_KERNEL_AVX2 1
+    #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define PARTICLE_KERNEL_SSE 1
+    #include <emmintrin.h>
+#endif
+
+void updateParticlesScalar(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::size_t aBegin, std::size_t aEnd)
+{
+    const float dt = aParams.dt;
+    const float accX = aParams.acceleration.x * dt;
+    const float accY = aParams.acceleration.y * dt;
+    const float accZ = aParams.acceleration.z * dt;
+    const float lifeStep = aParams.lifeDecay * dt;
+
+    for (std::size_t i = aBegin; i < aEnd; ++i)
+    {
+        const float life = aStorage.life[i];
+        if (life <= 0.0f)
+        {
+            continue;
+        }
+
+        aStorage.positionX[i] += aStorage.velocityX[i] * dt;
+        aStorage.positionY[i] += aStorage.velocityY[i] * dt;
+        aStorage.positionZ[i] += aStorage.velocityZ[i] * dt;
+        aStorage.velocityX[i] += accX;
+        aStorage.velocityY[i] += accY;
+        aStorage.velocityZ[i] += accZ;
+        aStorage.life[i] = life - lifeStep;
+    }
+}
+
+void advanceParticles(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::uint64_t aSteps, std::size_t aBegin, std::size_t aEnd)
+{
+    const float dt = aParams.dt;
+    const float t = static_cast<float>(aSteps) * dt;
+    const float previousT = t - dt;
+    const glm::vec3 drift = aParams.acceleration * (0.5f * t * previousT);
+    const glm::vec3 previousDrift = aParams.acceleration * (0.5f * previousT * (previousT - dt));
+    const glm::vec3 gain = aParams.acceleration * t;
+    const float lifeLoss = aParams.lifeDecay * t;
+
+    for (std::size_t i = aBegin; i < aEnd; ++i)
+    {
+        if (aStorage.life[i] <= 0.0f)
+        {
+            continue;
+        }
+        const glm::vec3 position(aStorage.positionX[i], aStorage.positionY[i], aStorage.positionZ[i]);
+        const glm::vec3 velocity(aStorage.velocityX[i], aStorage.velocityY[i], aStorage.velocityZ[i]);
+        const glm::vec3 previous = position + velocity * previousT + previousDrift;
+        const glm::vec3 current = position + velocity * t + drift;
+        aStorage.previousX[i] = previous.x;
+        aStorage.previousY[i] = previous.y;
+        aStorage.previousZ[i] = previous.z;
+        aStorage.positionX[i] = current.x;
+        aStorage.positionY[i] = current.y;
+        aStorage.positionZ[i] = current.z;
+        aStorage.velocityX[i] = velocity.x + gain.x;
+        aStorage.velocityY[i] = velocity.y + gain.y;
+        aStorage.velocityZ[i] = velocity.z + gain.z;
+        aStorage.life[i] -= lifeLoss;
+    }
+}
+
+#if PARTICLE_KERNEL_AVX2
+
+static void updateParticlesSimd(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::size_t aBegin, std::size_t aEnd)
+{
+    const __m256 dt = _mm256_set1_ps(aParams.dt);
+    const __m256 accX = _mm256_set1_ps(aParams.acceleration.x * aParams.dt);
+    const __m256 accY = _mm256_set1_ps(aParams.acceleration.y * aParams.dt);
+    const __m256 accZ = _mm256_set1_ps(aParams.acceleration.z * aParams.dt);
+    const __m256 lifeStep = _mm256_set1_ps(aParams.lifeDecay * aParams.dt);
+    const __m256 zero = _mm256_setzero_ps();
+
+    for (std::size_t i = aBegin; i < aEnd; i += 8)
+    {
+        const __m256 life = _mm256_load_ps(aStorage.life + i);
+        const __m256 alive = _mm256_cmp_ps(life, zero, _CMP_GT_OQ);
+        if (_mm256_movemask_ps(alive) == 0)
+        {
+            continue;
+        }
+
+        auto store = [alive](float* aStream, __m256 aValue) {
+            _mm256_store_ps(aStream, _mm256_blendv_ps(_mm256_load_ps(aStream), aValue, alive));
+        };
+
+        const __m256 velX = _mm256_load_ps(aStorage.velocityX + i);
+        const __m256 velY = _mm256_load_ps(aStorage.velocityY + i);
+        const __m256 velZ = _mm256_load_ps(aStorage.velocityZ + i);
+        store(aStorage.positionX + i, _mm256_add_ps(_mm256_load_ps(aStorage.positionX + i), _mm256_mul_ps(velX, dt)));
+        store(aStorage.positionY + i, _mm256_add_ps(_mm256_load_ps(aStorage.positionY + i), _mm256_mul_ps(velY, dt)));
+        store(aStorage.positionZ + i, _mm256_add_ps(_mm256_load_ps(aStorage.positionZ + i), _mm256_mul_ps(velZ, dt)));
+        store(aStorage.velocityX + i, _mm256_add_ps(velX, accX));
+        store(aStorage.velocityY + i, _mm256_add_ps(velY, accY));
+        store(aStorage.velocityZ + i, _mm256_add_ps(velZ, accZ));
+        store(aStorage.life + i, _mm256_sub_ps(life, lifeStep));
+    }
+}
+
+#elif PARTICLE_KERNEL_SSE
+
+static void updateParticlesSimd(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::size_t aBegin, std::size_t aEnd)
+{
+    const __m128 dt = _mm_set1_ps(aParams.dt);
+    const __m128 accX = _mm_set1_ps(aParams.acceleration.x * aParams.dt);
+    const __m128 accY = _mm_set1_ps(aParams.acceleration.y * aParams.dt);
+    const __m128 accZ = _mm_set1_ps(aParams.acceleration.z * aParams.dt);
+    const __m128 lifeStep = _mm_set1_ps(aParams.lifeDecay * aParams.dt);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (std::size_t i = aBegin; i < aEnd; i += 4)
+    {
+        const __m128 life = _mm_load_ps(aStorage.life + i);
+        const __m128 alive = _mm_cmpgt_ps(life, zero);
+        if (_mm_movemask_ps(alive) == 0)
+        {
+            continue;
+        }
+
+        // SSE2 has no blendv, select with and/andnot/or instead
+        auto store = [alive](float* aStream, __m128 aValue) {
+            const __m128 old = _mm_load_ps(aStream);
+            _mm_store_ps(aStream, _mm_or_ps(_mm_and_ps(alive, aValue), _mm_andnot_ps(alive, old)));
+        };
+
+        const __m128 velX = _mm_load_ps(aStorage.velocityX + i);
+        const __m128 velY = _mm_load_ps(aStorage.velocityY + i);
+        const __m128 velZ = _mm_load_ps(aStorage.velocityZ + i);
+        store(aStorage.positionX + i, _mm_add_ps(_mm_load_ps(aStorage.positionX + i), _mm_mul_ps(velX, dt)));
+        store(aStorage.positionY + i, _mm_add_ps(_mm_load_ps(aStorage.positionY + i), _mm_mul_ps(velY, dt)));
+        store(aStorage.positionZ + i, _mm_add_ps(_mm_load_ps(aStorage.positionZ + i), _mm_mul_ps(velZ, dt)));
+        store(aStorage.velocityX + i, _mm_add_ps(velX, accX));
+        store(aStorage.velocityY + i, _mm_add_ps(velY, accY));
+        store(aStorage.velocityZ + i, _mm_add_ps(velZ, accZ));
+        store(aStorage.life + i, _mm_sub_ps(life, lifeStep));
+    }
+}
+
+#endif
+
+void updateParticles(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::size_t aBegin, std::size_t aEnd)
+{
+    aEnd = std::min(aStorage.paddedCount, (aEnd + cParticleLaneWidth - 1) / cParticleLaneWidth * cParticleLaneWidth);
+#if PARTICLE_KERNEL_AVX2 || PARTICLE_KERNEL_SSE
+    updateParticlesSimd(aStorage, aParams, aBegin, aEnd);
+#else
+    updateParticlesScalar(aStorage, aParams, aBegin, aEnd);
+#endif
+}
+
+std::uint16_t floatToHalf(float aValue)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &aValue, sizeof(bits));
+    const std::uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    std::uint32_t half;
+    if (bits >= 0x47800000u)
+    {
+        // Too large for a half: infinity, NaN stays NaN
+        half = bits > 0x7F800000u ? 0x7E00u : 0x7C00u;
+    }
+    else if (bits < 0x38800000u)
+    {
+        // Subnormal or zero: adding the magic value lines the mantissa up
+        // with the half subnormal bits and lets the FPU round
+        const std::uint32_t magicBits = 0x3F000000u;
+        float magic;
+        std::memcpy(&magic, &magicBits, sizeof(magic));
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        value += magic;
+        std::memcpy(&half, &value, sizeof(half));
+        half -= magicBits;
+    }
+    else
+    {
+        // Rebias the exponent and round the 13 dropped bits to nearest even
+        const std::uint32_t mantissaOdd = (bits >> 13) & 1u;
+        bits += 0xC8000FFFu + mantissaOdd;
+        half = bits >> 13;
+    }
+    return static_cast<std::uint16_t>(half | (sign >> 16));
+}
+
+static std::uint32_t packUnorm8(float aValue)
+{
+    return static_cast<std::uint32_t>(std::clamp(aValue, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+static void packParticleInstancesScalar(const ParticleStorage& aStorage, const std::uint32_t* aOrder, std::size_t aBegin, std::size_t aEnd, glm::vec3 aOrigin, float aInterpolation, ParticleInstance* aInstances, std::uint16_t aEmitter)
+{
+    // Written as two products, so aInterpolation 1 gives the current position exactly
+    const float keep = 1.0f - aInterpolation;
+    for (std::size_t k = aBegin; k < aEnd; ++k)
+    {
+        const std::size_t i = aOrder ? aOrder[k] : k;
+        ParticleInstance& instance = aInstances[k];
+        const float x = aStorage.positionX[i] * aInterpolation + aStorage.previousX[i] * keep;
+        const float y = aStorage.positionY[i] * aInterpolation + aStorage.previousY[i] * keep;
+        const float z = aStorage.positionZ[i] * aInterpolation + aStorage.previousZ[i] * keep;
+        instance.position[0] = floatToHalf(x - aOrigin.x);
+        instance.position[1] = floatToHalf(y - aOrigin.y);
+        instance.position[2] = floatToHalf(z - aOrigin.z);
+        instance.scale = floatToHalf(aStorage.scale[i]);
+        instance.color = packUnorm8(aStorage.colorR[i])
+            | (packUnorm8(aStorage.colorG[i]) << 8)
+            | (packUnorm8(aStorage.colorB[i]) << 16)
+            | (packUnorm8(aStorage.colorA[i]) << 24);
+        const float lifeNorm = std::clamp(aStorage.life[i] / aStorage.initialLife[i], 0.0f, 1.0f);
+        instance.life = static_cast<std::uint16_t>(lifeNorm * 65535.0f + 0.5f);
+        instance.emitter = aEmitter;
+    }
+}
+
+#if PARTICLE_KERNEL_AVX2 || PARTICLE_KERNEL_SSE
+
+// floatToHalf() for four lanes, each result in the low 16 bits of its lane
+static __m128i floatToHalf4(__m128 aValue)
+{
+    __m128i bits = _mm_castps_si128(aValue);
+    const __m128i sign = _mm_and_si128(bits, _mm_set1_epi32(int(0x80000000u)));
+    bits = _mm_xor_si128(bits, sign);
+
+    const __m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1));
+    const __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(bits, _mm_set1_epi32(int(0xC8000FFFu))), mantissaOdd), 13);
+
+    const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(0x3F000000));
+    const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(bits), magic)), _mm_castps_si128(magic));
+
+    // The sign is cleared, so signed compares are safe
+    const __m128i isNan = _mm_cmpgt_epi32(bits, _mm_set1_epi32(0x7F800000));
+    const __m128i special = _mm_or_si128(_mm_set1_epi32(0x7C00), _mm_and_si128(isNan, _mm_set1_epi32(0x0200)));
+    const __m128i isSpecial = _mm_cmpgt_epi32(bits, _mm_set1_epi32(0x477FFFFF));
+    const __m128i isSubnormal = _mm_cmplt_epi32(bits, _mm_set1_epi32(0x38800000));
+
+    auto select = [](__m128i aMask, __m128i aTrue, __m128i aFalse) {
+        return _mm_or_si128(_mm_and_si128(aMask, aTrue), _mm_andnot_si128(aMask, aFalse));
+    };
+    const __m128i half = select(isSpecial, special, select(isSubnormal, subnormal, normal));
+    return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+}
+
+static __m128i packUnorm4(__m128 aValue, float aMax)
+{
+    const __m128 clamped = _mm_min_ps(_mm_max_ps(aValue, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(clamped, _mm_set1_ps(aMax)), _mm_set1_ps(0.5f)));
+}
+
+// Packs four particles per iteration and transposes the four words of each
+// instance into place. Bit-identical to packParticleInstancesScalar().
+static void packParticleInstancesSimd(const ParticleStorage& aStorage, const std::uint32_t* aOrder, std::size_t aBegin, std::size_t aEnd, glm::vec3 aOrigin, float aInterpolation, ParticleInstance* aInstances, std::uint16_t aEmitter)
+{
+    const __m128 interpolation = _mm_set1_ps(aInterpolation);
+    const __m128 keep = _mm_set1_ps(1.0f - aInterpolation);
+    const __m128 originX = _mm_set1_ps(aOrigin.x);
+    const __m128 originY = _mm_set1_ps(aOrigin.y);
+    const __m128 originZ = _mm_set1_ps(aOrigin.z);
+
+    std::size_t k = aBegin;
+    for (; k + 4 <= aEnd; k += 4)
+    {
+        auto load = [&](const float* aStream) {
+            if (!aOrder)
+            {
+                return _mm_loadu_ps(aStream + k);
+            }
+            return _mm_setr_ps(aStream[aOrder[k]], aStream[aOrder[k + 1]], aStream[aOrder[k + 2]], aStream[aOrder[k + 3]]);
+        };
+
+        auto position = [&](const float* aCurrent, const float* aPrevious) {
+            return _mm_add_ps(_mm_mul_ps(load(aCurrent), interpolation), _mm_mul_ps(load(aPrevious), keep));
+        };
+        const __m128i x = floatToHalf4(_mm_sub_ps(position(aStorage.positionX, aStorage.previousX), originX));
+        const __m128i y = floatToHalf4(_mm_sub_ps(position(aStorage.positionY, aStorage.previousY), originY));
+        const __m128i z = floatToHalf4(_mm_sub_ps(position(aStorage.positionZ, aStorage.previousZ), originZ));
+        const __m128i scale = floatToHalf4(load(aStorage.scale));
+
+        const __m128i color = _mm_or_si128(
+            _mm_or_si128(packUnorm4(load(aStorage.colorR), 255.0f), _mm_slli_epi32(packUnorm4(load(aStorage.colorG), 255.0f), 8)),
+            _mm_or_si128(_mm_slli_epi32(packUnorm4(load(aStorage.colorB), 255.0f), 16), _mm_slli_epi32(packUnorm4(load(aStorage.colorA), 255.0f), 24)));
+        const __m128i life = packUnorm4(_mm_div_ps(load(aStorage.life), load(aStorage.initialLife)), 65535.0f);
+        const __m128i emitter = _mm_set1_epi32(int(std::uint32_t(aEmitter) << 16));
+
+        __m128 word0 = _mm_castsi128_ps(_mm_or_si128(x, _mm_slli_epi32(y, 16)));
+        __m128 word1 = _mm_castsi128_ps(_mm_or_si128(z, _mm_slli_epi32(scale, 16)));
+        __m128 word2 = _mm_castsi128_ps(color);
+        __m128 word3 = _mm_castsi128_ps(_mm_or_si128(life, emitter));
+        _MM_TRANSPOSE4_PS(word0, word1, word2, word3);
+
+        float* out = reinterpret_cast<float*>(aInstances + k);
+        _mm_storeu_ps(out, word0);
+        _mm_storeu_ps(out + 4, word1);
+        _mm_storeu_ps(out + 8, word2);
+        _mm_storeu_ps(out + 12, word3);
+    }
+    packParticleInstancesScalar(aStorage, aOrder, k, aEnd, aOrigin, aInterpolation, aInstances, aEmitter);
+}
+
+#endif
+
+void packParticleInstances(const ParticleStorage& aStorage, const std::uint32_t* aOrder, std::size_t aBegin, std::size_t aEnd, glm::vec3 aOrigin, float aInterpolation, ParticleInstance* aInstances, std::uint16_t aEmitter)
+{
+#if PARTICLE_KERNEL_AVX2 || PARTICLE_KERNEL_SSE
+    packParticleInstancesSimd(aStorage, aOrder, aBegin, aEnd, aOrigin, aInterpolation, aInstances, aEmitter);
+#else
+    packParticleInstancesScalar(aStorage, aOrder, aBegin, aEnd, aOrigin, aInterpolation, aInstances, aEmitter);
+#endif
+}
+
+void storePreviousPositions(ParticleStorage& aStorage, std::size_t aBegin, std::size_t aEnd)
+{
+    const std::size_t count = aEnd - aBegin;
+    std::memcpy(aStorage.previousX + aBegin, aStorage.positionX + aBegin, count * sizeof(float));
+    std::memcpy(aStorage.previousY + aBegin, aStorage.positionY + aBegin, count * sizeof(float));
+    std::memcpy(aStorage.previousZ + aBegin, aStorage.positionZ + aBegin, count * sizeof(float));
+}
+
+const char* particleKernelName()
+{
+#if PARTICLE_KERNEL_AVX2
+    return "avx2";
+#elif PARTICLE_KERNEL_SSE
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
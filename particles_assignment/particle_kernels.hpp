@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "particle_storage.hpp"
+
+struct ParticleUpdateParams
+{
+    float dt = 0.0f;
+    glm::vec3 acceleration = glm::vec3(0.0f, 0.2f, 0.0f);
+    float lifeDecay = 1.5f;
+};
+
+// Render instance of one particle, 16 bytes instead of the 28 of a float
+// vec3 + vec4. Half-float positions are relative to the emitter, which keeps
+// their precision independent of where the effect is in the world.
+struct ParticleInstance
+{
+    std::uint16_t position[3]; // half float, position - emitter position
+    std::uint16_t scale;       // half float
+    std::uint32_t color;       // RGBA8 unorm tint, red in the lowest byte
+    std::uint16_t life;        // life / initial life as unorm16
+    std::uint16_t emitter;     // emitter record in a ParticleWorld, otherwise 0
+};
+static_assert(sizeof(ParticleInstance) == 16, "The instance layout is shared with particle_pack.compute.glsl");
+
+// Integrates the live particles in [aBegin, aEnd). Dead slots are left
+// untouched. Color and size over life are evaluated when drawing, see
+// ParticleLifeCurves.
+// aBegin must be a multiple of cParticleLaneWidth; aEnd is rounded up to one.
+void updateParticles(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::size_t aBegin, std::size_t aEnd);
+
+// Writes aInstances[k] for k in [aBegin, aEnd) from particle aOrder[k], or
+// particle k if aOrder is null. Positions are interpolated between the
+// previous and the current step; aInterpolation 1 packs the current one.
+// Every instance is tagged with aEmitter.
+void packParticleInstances(const ParticleStorage& aStorage, const std::uint32_t* aOrder, std::size_t aBegin, std::size_t aEnd, glm::vec3 aOrigin, float aInterpolation, ParticleInstance* aInstances, std::uint16_t aEmitter = 0);
+
+// Runs aSteps (at least 1) steps of updateParticles() on the live particles
+// of [aBegin, aEnd) at once, in closed form: explicit Euler steps under
+// constant acceleration add up to p + v t + a t (t - dt) / 2. Previous
+// positions are those of step aSteps - 1. Matches aSteps updateParticles()
+// calls up to float rounding.
+void advanceParticles(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::uint64_t aSteps, std::size_t aBegin, std::size_t aEnd);
+
+// Copies the positions of [aBegin, aEnd) into the previous position streams;
+// run at the start of each step
+void storePreviousPositions(ParticleStorage& aStorage, std::size_t aBegin, std::size_t aEnd);
+
+// Round to nearest even, like the GPU conversion; out of range values become
+// infinity.
+std::uint16_t floatToHalf(float aValue);
+
+// Portable reference implementation, always available.
+void updateParticlesScalar(ParticleStorage& aStorage, const ParticleUpdateParams& aParams, std::size_t aBegin, std::size_t aEnd);
+
+// Name of the instruction set updateParticles() was compiled for.
+const char* particleKernelName();
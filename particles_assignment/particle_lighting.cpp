@@ -0,0 +1,46 @@
+#include "particle_lighting.hpp"
+
+ParticleAmbientSH::ParticleAmbientSH()
+{
+    setBand(0, 0.2f * glm::vec3(1.0f, 0.9f, 0.8f));
+}
+
+ParticleAmbientSH ParticleAmbientSH::constant(glm::vec3 aColor)
+{
+    ParticleAmbientSH sh;
+    sh.mCoefficients.fill(0.0f);
+    sh.setBand(0, aColor);
+    return sh;
+}
+
+ParticleAmbientSH ParticleAmbientSH::hemisphere(glm::vec3 aSky, glm::vec3 aGround, glm::vec3 aUp)
+{
+    // The linear band of the hemisphere lighting along aUp, convolved with
+    // the cosine lobe, is (sky - ground) / 2 * cos
+    ParticleAmbientSH sh = constant(0.5f * (aSky + aGround));
+    const glm::vec3 up = glm::normalize(aUp);
+    const glm::vec3 slope = 0.5f * (aSky - aGround);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        sh.setBand(1 + axis, slope * up[axis]);
+    }
+    return sh;
+}
+
+glm::vec3 ParticleAmbientSH::evaluate(glm::vec3 aNormal) const
+{
+    glm::vec3 result(0.0f);
+    const float basis[4] = { 1.0f, aNormal.x, aNormal.y, aNormal.z };
+    for (int band = 0; band < 4; ++band)
+    {
+        result += basis[band] * glm::vec3(mCoefficients[3 * band], mCoefficients[3 * band + 1], mCoefficients[3 * band + 2]);
+    }
+    return result;
+}
+
+void ParticleAmbientSH::setBand(int aBand, glm::vec3 aColor)
+{
+    mCoefficients[3 * aBand] = aColor.r;
+    mCoefficients[3 * aBand + 1] = aColor.g;
+    mCoefficients[3 * aBand + 2] = aColor.b;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <glm/glm.hpp>
+
+// Lighting of the particle material, the u_lightingMode material parameter.
+// The program is shared, so systems without it get Fragment.
+enum class ParticleLighting
+{
+    Fragment = 0, // Phong per fragment against the camera-facing quad normal
+    Vertex = 1    // Wrapped diffuse and ParticleAmbientSH per quad corner, no specular
+};
+
+/**
+ * @brief Ambient light of the per-vertex particle lighting as first order
+ * spherical harmonics.
+ *
+ * The coefficients are stored already convolved with the cosine lobe and
+ * divided by pi, so the shader gets the diffuse ambient for a normal n with
+ * one multiply-add per band: c0 + c1 n.x + c2 n.y + c3 n.z.
+ */
+class ParticleAmbientSH
+{
+public:
+    // The ambient of the Phong mode: 0.2 of a warm white light, from everywhere
+    ParticleAmbientSH();
+
+    static ParticleAmbientSH constant(glm::vec3 aColor);
+    // Sky color above, ground color below aUp. Exact at first order:
+    // (sky + ground) / 2 + (sky - ground) / 2 dot(n, up).
+    static ParticleAmbientSH hemisphere(glm::vec3 aSky, glm::vec3 aGround, glm::vec3 aUp = glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // Same evaluation as particle.vertex.glsl
+    glm::vec3 evaluate(glm::vec3 aNormal) const;
+
+    // RGB per band, for a float[12] uniform
+    const std::array<float, 12>& coefficients() const { return mCoefficients; }
+
+private:
+    void setBand(int aBand, glm::vec3 aColor);
+
+    std::array<float, 12> mCoefficients{};
+};
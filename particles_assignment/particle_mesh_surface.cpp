@@ -0,0 +1,101 @@
+#include "particle_mesh_surface.hpp"
+
+#include <numeric>
+#include <utility>
+
+namespace {
+
+std::vector<glm::vec3> meshCorners(const ObjMesh& aMesh)
+{
+    std::vector<glm::vec3> corners;
+    corners.reserve(aMesh.indices.size() - aMesh.indices.size() % 3);
+    for (std::size_t i = 0; i + 2 < aMesh.indices.size(); i += 3)
+    {
+        for (std::size_t corner = 0; corner < 3; ++corner)
+        {
+            corners.push_back(aMesh.vertices[aMesh.indices[i + corner]].position);
+        }
+    }
+    return corners;
+}
+
+} // namespace
+
+MeshSurfaceSampler::MeshSurfaceSampler(const ObjMesh& aMesh)
+    : MeshSurfaceSampler(meshCorners(aMesh))
+{}
+
+MeshSurfaceSampler::MeshSurfaceSampler(std::vector<glm::vec3> aCorners)
+    : mCorners(std::move(aCorners))
+{
+    const std::size_t count = mCorners.size() / 3;
+    mCorners.resize(3 * count);
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Areas in double, the table is built from their running differences
+    std::vector<double> areas(count);
+    for (std::size_t t = 0; t < count; ++t)
+    {
+        const glm::vec3* corners = &mCorners[3 * t];
+        areas[t] = 0.5 * double(glm::length(glm::cross(corners[1] - corners[0], corners[2] - corners[0])));
+    }
+    const double total = std::accumulate(areas.begin(), areas.end(), 0.0);
+    mArea = static_cast<float>(total);
+
+    // Vose's alias method: scaled to a mean of 1, every column below 1 is
+    // topped up from one column above 1
+    std::vector<double> scaled(count, 1.0);
+    if (total > 0.0)
+    {
+        for (std::size_t t = 0; t < count; ++t)
+        {
+            scaled[t] = areas[t] * double(count) / total;
+        }
+    }
+    std::vector<std::uint32_t> small;
+    std::vector<std::uint32_t> large;
+    for (std::size_t t = 0; t < count; ++t)
+    {
+        (scaled[t] < 1.0 ? small : large).push_back(static_cast<std::uint32_t>(t));
+    }
+
+    mTable.resize(count);
+    while (!small.empty() && !large.empty())
+    {
+        const std::uint32_t less = small.back();
+        small.pop_back();
+        const std::uint32_t more = large.back();
+        large.pop_back();
+
+        mTable[less] = AliasEntry{ static_cast<float>(scaled[less]), more };
+        scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+        (scaled[more] < 1.0 ? small : large).push_back(more);
+    }
+    // What is left is 1 up to rounding
+    for (const std::uint32_t t : large)
+    {
+        mTable[t] = AliasEntry{ 1.0f, t };
+    }
+    for (const std::uint32_t t : small)
+    {
+        mTable[t] = AliasEntry{ 1.0f, t };
+    }
+}
+
+float MeshSurfaceSampler::probability(std::size_t aTriangle) const
+{
+    // The own column plus the columns that alias to aTriangle; full columns
+    // alias to themselves and add nothing
+    double sum = mTable[aTriangle].probability;
+    for (const AliasEntry& entry : mTable)
+    {
+        if (entry.alias == aTriangle)
+        {
+            sum += 1.0 - entry.probability;
+        }
+    }
+    return static_cast<float>(sum / double(mTable.size()));
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "counter_rng.hpp"
+#include "obj_file_loading.hpp"
+
+/**
+ * @brief Uniformly distributed random points on the surface of a triangle mesh.
+ *
+ * A triangle is picked with probability proportional to its area from a
+ * Vose alias table: a random column and a biased coin between the column's
+ * own triangle and its alias. Sampling is O(1) per point for any triangle
+ * count; building the table is O(n). The point inside the triangle uses the
+ * square root warp of the barycentric coordinates.
+ */
+class MeshSurfaceSampler
+{
+public:
+    MeshSurfaceSampler() = default;
+    // Triangles of aMesh.indices, in mesh units
+    explicit MeshSurfaceSampler(const ObjMesh& aMesh);
+    // Three corners per triangle
+    explicit MeshSurfaceSampler(std::vector<glm::vec3> aCorners);
+
+    bool empty() const { return mTable.empty(); }
+    std::size_t triangleCount() const { return mTable.size(); }
+    float area() const { return mArea; }
+
+    // Probability of picking aTriangle, read back from the table in O(n).
+    // Equals area / total area up to rounding.
+    float probability(std::size_t aTriangle) const;
+
+    // Triangle for one 32-bit random value: the high part of value * count
+    // is the column, the low part the coin
+    std::size_t sampleTriangle(std::uint32_t aRandom) const
+    {
+        const std::uint64_t scaled = std::uint64_t(aRandom) * mTable.size();
+        const std::size_t column = static_cast<std::size_t>(scaled >> 32);
+        const float coin = static_cast<float>(static_cast<std::uint32_t>(scaled) >> 8) * (1.0f / 16777216.0f);
+        return coin < mTable[column].probability ? column : mTable[column].alias;
+    }
+
+    // Three draws. An empty sampler returns the origin.
+    glm::vec3 sample(CounterRandom& aRandom) const
+    {
+        const std::uint32_t pick = aRandom.nextUint();
+        const float r = std::sqrt(aRandom.nextFloat());
+        const float s = aRandom.nextFloat();
+        if (mTable.empty())
+        {
+            return glm::vec3(0.0f);
+        }
+        const glm::vec3* corners = &mCorners[3 * sampleTriangle(pick)];
+        return corners[0] * (1.0f - r) + corners[1] * (r * (1.0f - s)) + corners[2] * (r * s);
+    }
+
+private:
+    struct AliasEntry
+    {
+        // Chance to keep the column's own triangle
+        float probability;
+        std::uint32_t alias;
+    };
+
+    std::vector<glm::vec3> mCorners;
+    std::vector<AliasEntry> mTable;
+    float mArea = 0.0f;
+};
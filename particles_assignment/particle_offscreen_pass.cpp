@@ -0,0 +1,146 @@
+#include "particle_offscreen_pass.hpp"
+#include "error_handling.hpp"
+#include "ogl_geometry_construction.hpp"
+#include "texture.hpp"
+
+#include <algorithm>
+
+namespace {
+
+OpenGLResource createDepthTexture(int aWidth, int aHeight)
+{
+    // Same format as the default framebuffer depth, which glBlitFramebuffer requires
+    OpenGLResource texture = createTexture();
+    GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture.get()));
+    GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, aWidth, aHeight, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    return texture;
+}
+
+void checkFramebuffer(const char* aName)
+{
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        throw OpenGLError(std::string(aName) + " framebuffer is not complete!");
+    }
+}
+
+} // namespace
+
+ParticleOffscreenPass::ParticleOffscreenPass(MaterialFactory& aMaterialFactory)
+    : mDownsampleProgram(std::static_pointer_cast<OGLShaderProgram>(aMaterialFactory.getShaderProgram("particle_depth_downsample")))
+    , mUpsampleProgram(std::static_pointer_cast<OGLShaderProgram>(aMaterialFactory.getShaderProgram("particle_upsample")))
+    , mQuad(generateQuadTex())
+{}
+
+void ParticleOffscreenPass::resize(int aWidth, int aHeight, int aDownsample)
+{
+    mWidth = aWidth;
+    mHeight = aHeight;
+    mDownsample = aDownsample;
+    const int lowWidth = std::max(1, (aWidth + aDownsample - 1) / aDownsample);
+    const int lowHeight = std::max(1, (aHeight + aDownsample - 1) / aDownsample);
+
+    mSceneDepthFramebuffer = createFramebuffer();
+    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, mSceneDepthFramebuffer.get()));
+    mSceneDepth = std::make_shared<OGLTexture>(createDepthTexture(aWidth, aHeight));
+    GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mSceneDepth->texture.get(), 0));
+    GL_CHECK(glDrawBuffer(GL_NONE));
+    checkFramebuffer("Scene depth");
+
+    mParticleFramebuffer = createFramebuffer();
+    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, mParticleFramebuffer.get()));
+    mParticleColor = std::make_shared<OGLTexture>(createColorTexture(lowWidth, lowHeight, GL_RGBA16F, GL_RGBA, GL_FLOAT));
+    // Bilinear filtering for the upsample away from depth edges
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mParticleColor->texture.get(), 0));
+    mParticleDepth = std::make_shared<OGLTexture>(createDepthTexture(lowWidth, lowHeight));
+    GL_CHECK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, mParticleDepth->texture.get(), 0));
+    checkFramebuffer("Low resolution particle");
+
+    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+}
+
+void ParticleOffscreenPass::drawQuad()
+{
+    // The pass also runs for the wireframe view
+    GLint polygonMode[2];
+    GL_CHECK(glGetIntegerv(GL_POLYGON_MODE, polygonMode));
+    GL_CHECK(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
+    mQuad.bind();
+    mQuad.draw();
+    GL_CHECK(glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]));
+}
+
+void ParticleOffscreenPass::begin(int aDownsample, float aNear, float aFar)
+{
+    GLint viewport[4];
+    GL_CHECK(glGetIntegerv(GL_VIEWPORT, viewport));
+    if (viewport[2] != mWidth || viewport[3] != mHeight || aDownsample != mDownsample)
+    {
+        resize(viewport[2], viewport[3], aDownsample);
+    }
+    mNear = aNear;
+    mFar = aFar;
+
+    GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, 0));
+    GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mSceneDepthFramebuffer.get()));
+    GL_CHECK(glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST));
+
+    // Reduce the depth: a full screen quad writes the farthest depth of each block
+    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, mParticleFramebuffer.get()));
+    const int lowWidth = std::max(1, (mWidth + mDownsample - 1) / mDownsample);
+    const int lowHeight = std::max(1, (mHeight + mDownsample - 1) / mDownsample);
+    GL_CHECK(glViewport(0, 0, lowWidth, lowHeight));
+    const GLfloat transparent[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    GL_CHECK(glClearBufferfv(GL_COLOR, 0, transparent));
+
+    GLboolean blend = GL_FALSE;
+    GL_CHECK(glGetBooleanv(GL_BLEND, &blend));
+    GL_CHECK(glDisable(GL_BLEND));
+    GL_CHECK(glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
+    GL_CHECK(glDepthMask(GL_TRUE));
+    GL_CHECK(glDepthFunc(GL_ALWAYS));
+    mDownsampleProgram->use();
+    mDownsampleProgram->setMaterialParameters({
+        { "u_sceneDepth", TextureInfo{ "sceneDepth", mSceneDepth } },
+        { "u_downsample", mDownsample },
+    });
+    drawQuad();
+
+    // Particle state: depth tested against the reduced depth, not written
+    GL_CHECK(glDepthFunc(GL_LESS));
+    GL_CHECK(glDepthMask(GL_FALSE));
+    GL_CHECK(glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
+    if (blend)
+    {
+        GL_CHECK(glEnable(GL_BLEND));
+    }
+}
+
+void ParticleOffscreenPass::end()
+{
+    GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    GL_CHECK(glViewport(0, 0, mWidth, mHeight));
+
+    // The target holds the sum of the particles, it is added as is
+    GL_CHECK(glEnable(GL_BLEND));
+    GL_CHECK(glBlendFunc(GL_ONE, GL_ONE));
+    GL_CHECK(glDisable(GL_DEPTH_TEST));
+    mUpsampleProgram->use();
+    mUpsampleProgram->setMaterialParameters({
+        { "u_particleColor", TextureInfo{ "particleColor", mParticleColor } },
+        { "u_particleDepth", TextureInfo{ "particleDepth", mParticleDepth } },
+        { "u_sceneDepth", TextureInfo{ "sceneDepth", mSceneDepth } },
+        { "u_near", mNear },
+        { "u_far", mFar },
+    });
+    drawQuad();
+
+    GL_CHECK(glEnable(GL_DEPTH_TEST));
+    GL_CHECK(glBlendFunc(GL_SRC_ALPHA, GL_ONE));
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <memory>
+#include <glad/glad.h>
+
+#include "ogl_resource.hpp"
+#include "ogl_material_factory.hpp"
+#include "ogl_geometry_factory.hpp"
+
+/**
+ * @brief Renders additive particles at a fraction of the screen resolution.
+ *
+ * begin() copies the scene depth out of the default framebuffer, reduces it
+ * to the low-resolution target (farthest depth of each block) and binds
+ * that target, so the particle draws are depth tested against the scene at
+ * 1/4 or 1/16 of the fragments. end() adds the result back onto the
+ * default framebuffer with a nearest-depth upsample: where the low-res
+ * depths around a pixel agree with the scene depth the particles are
+ * filtered bilinearly, at depth edges the texel with the closest depth is
+ * taken, so particles do not bleed over foreground geometry.
+ *
+ * Only valid for blending that is order independent and adds to the
+ * destination, like the GL_SRC_ALPHA, GL_ONE particle blending.
+ */
+class ParticleOffscreenPass
+{
+public:
+    // Programs are compiled by the material factory from the shader directory
+    explicit ParticleOffscreenPass(MaterialFactory& aMaterialFactory);
+
+    // aDownsample is the size ratio of the screen to the target, e.g. 2 or 4.
+    // aNear and aFar are the camera planes, used to compare depths linearly.
+    void begin(int aDownsample, float aNear, float aFar);
+    // Composites onto the default framebuffer and restores the viewport
+    void end();
+
+private:
+    void resize(int aWidth, int aHeight, int aDownsample);
+    void drawQuad();
+
+    std::shared_ptr<OGLShaderProgram> mDownsampleProgram;
+    std::shared_ptr<OGLShaderProgram> mUpsampleProgram;
+    OGLGeometry mQuad;
+
+    int mWidth = 0;
+    int mHeight = 0;
+    int mDownsample = 0;
+    float mNear = 0.1f;
+    float mFar = 100.0f;
+
+    // Full resolution copy of the scene depth
+    OpenGLResource mSceneDepthFramebuffer;
+    std::shared_ptr<OGLTexture> mSceneDepth;
+    // Low resolution particle color and reduced depth
+    OpenGLResource mParticleFramebuffer;
+    std::shared_ptr<OGLTexture> mParticleColor;
+    std::shared_ptr<OGLTexture> mParticleDepth;
+};
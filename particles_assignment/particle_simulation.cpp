@@ -0,0 +1,390 @@
+#include "particle_simulation.hpp"
+#include "particle_effect.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+// Built once; the policies are plain settings, so this has no per-call cost
+static const FireParticleSpawner cFireSpawner = fireParticleSpawner();
+
+void respawnParticle(ParticleStorage& aStorage, std::size_t i, glm::vec3 aEmitterPos, CounterRandom& aRandom)
+{
+    // The draw order is mirrored by particle_emit.compute.glsl
+    cFireSpawner.spawn(aStorage, i, aEmitterPos, aRandom);
+}
+
+std::size_t emitParticles(ParticleStorage& aStorage, std::size_t aCount, const ParticleStepParams& aParams, WorkerPool& aPool)
+{
+    return emitParticles(aStorage, aCount, aParams, aPool, respawnParticle);
+}
+
+void compactParticles(ParticleStorage& aStorage)
+{
+    std::size_t i = 0;
+    while (i < aStorage.aliveCount)
+    {
+        if (aStorage.life[i] > 0.0f)
+        {
+            ++i;
+            continue;
+        }
+        // The particle moved into slot i has not been checked yet
+        aStorage.kill(i);
+    }
+}
+
+unsigned int simulateParticles(ParticleStorage& aStorage, const ParticleStepParams& aParams, std::size_t aEmitCount, WorkerPool& aPool, ParticleGrid* aGrid)
+{
+    emitParticles(aStorage, aEmitCount, aParams, aPool);
+
+    if (aGrid && aParams.separation.radius > 0.0f)
+    {
+        aGrid->build(aStorage, aParams.separation.radius);
+        applyParticleSeparation(aStorage, *aGrid, aParams.separation, aParams.update.dt, aPool);
+    }
+
+    // New particles are integrated in the same step, so they never render
+    // at their spawn state
+    const std::size_t alive = aStorage.aliveCount;
+    aPool.parallelFor(particleChunkCount(alive), [&](std::size_t aChunk) {
+        const std::size_t begin = aChunk * cParticleChunkSize;
+        const std::size_t end = std::min(alive, begin + cParticleChunkSize);
+        storePreviousPositions(aStorage, begin, end);
+        applyParticleTurbulence(aStorage, aParams.turbulence, aParams.update.dt, begin, end);
+        applyParticleCollision(aStorage, aParams.collision, aParams.update.dt, begin, end);
+        updateParticles(aStorage, aParams.update, begin, end);
+    });
+
+    compactParticles(aStorage);
+    return static_cast<unsigned int>(aStorage.aliveCount);
+}
+
+ParticleBounds liveParticleBounds(const ParticleStorage& aStorage, WorkerPool& aPool)
+{
+    // One box per chunk, merged in chunk order
+    const std::size_t alive = aStorage.aliveCount;
+    std::vector<ParticleBounds> chunkBounds(particleChunkCount(alive));
+    aPool.parallelFor(chunkBounds.size(), [&](std::size_t aChunk) {
+        const std::size_t end = std::min(alive, (aChunk + 1) * cParticleChunkSize);
+        ParticleBounds& bounds = chunkBounds[aChunk];
+        for (std::size_t i = aChunk * cParticleChunkSize; i < end; ++i)
+        {
+            bounds.grow(glm::vec3(aStorage.positionX[i], aStorage.positionY[i], aStorage.positionZ[i]));
+        }
+    });
+
+    ParticleBounds bounds;
+    for (const ParticleBounds& chunk : chunkBounds)
+    {
+        bounds.grow(chunk);
+    }
+    return bounds;
+}
+
+ParticleSimulation::ParticleSimulation(std::size_t aMaxParticles, std::uint64_t aSeed, bool aCpuStorage)
+    : mMaxParticles(aMaxParticles)
+    , mParticleQuota(aMaxParticles)
+    , mMaxInitialLife(cFireSpawner.lifetime.maxLife())
+    , mMaxScale(cFireSpawner.appearance.maxSize())
+{
+    if (aCpuStorage)
+    {
+        mStorage.resize(aMaxParticles);
+    }
+    mStepParams.seed = aSeed;
+    // Initial life averages 1, so this rate keeps the pool about full
+    mEmitter.setRate(aMaxParticles * mStepParams.update.lifeDecay);
+}
+
+unsigned int ParticleSimulation::beginStep(float aDt, glm::vec3 aEmitterPos)
+{
+    mStepParams.update.dt = aDt;
+    mStepParams.emitterPos = aEmitterPos;
+    mStepParams.frame = mStepIndex++;
+
+    const float rateScale = mMaxParticles > 0 ? float(mParticleQuota) / float(mMaxParticles) : 0.0f;
+    return mEmitter.takeEmission(aDt, rateScale);
+}
+
+unsigned int ParticleSimulation::update(float aDt, glm::vec3 aEmitterPos)
+{
+    const unsigned int emitCount = beginStep(aDt, aEmitterPos);
+    const std::size_t room = mParticleQuota > mStorage.aliveCount ? mParticleQuota - mStorage.aliveCount : 0;
+    if (mEffectStep)
+    {
+        return mEffectStep(mStorage, mStepParams, std::min<std::size_t>(emitCount, room), *mWorkerPool);
+    }
+    return simulateParticles(mStorage, mStepParams, std::min<std::size_t>(emitCount, room), *mWorkerPool, &mGrid);
+}
+
+void ParticleSimulation::clearEffect()
+{
+    mEffectStep = nullptr;
+    mMaxInitialLife = cFireSpawner.lifetime.maxLife();
+    mMaxScale = cFireSpawner.appearance.maxSize();
+}
+
+bool ParticleSimulation::isBallistic() const
+{
+    return !mEffectStep
+        && mStepParams.separation.radius <= 0.0f
+        && !mStepParams.turbulence.field
+        && !mStepParams.collision.field;
+}
+
+std::uint64_t ParticleSimulation::lifetimeSteps(float aDt) const
+{
+    const float lifeStep = mStepParams.update.lifeDecay * aDt;
+    if (lifeStep <= 0.0f)
+    {
+        return std::numeric_limits<std::uint64_t>::max();
+    }
+    // Plus one, as a particle is integrated in the step that emits it
+    return static_cast<std::uint64_t>(std::ceil(mMaxInitialLife / lifeStep)) + 1;
+}
+
+void ParticleSimulation::skipSteps(std::uint64_t aSteps, float aDt, glm::vec3 aEmitterPos)
+{
+    for (std::uint64_t step = 0; step < aSteps; ++step)
+    {
+        beginStep(aDt, aEmitterPos);
+    }
+    mStorage.aliveCount = 0;
+}
+
+unsigned int ParticleSimulation::fastForward(std::uint64_t aSteps, float aDt, glm::vec3 aEmitterPos)
+{
+    // One lifetime more than the particles of the last steps need, so the
+    // pool is about as full as a continuous run when their emission starts
+    const std::uint64_t lifetime = lifetimeSteps(aDt);
+    const std::uint64_t window = lifetime > std::numeric_limits<std::uint64_t>::max() / 2 ? lifetime : 2 * lifetime;
+    if (aSteps > window)
+    {
+        skipSteps(aSteps - window, aDt, aEmitterPos);
+        aSteps = window;
+    }
+    if (aSteps == 0)
+    {
+        return static_cast<unsigned int>(mStorage.aliveCount);
+    }
+    if (!isBallistic())
+    {
+        for (std::uint64_t step = 0; step < aSteps; ++step)
+        {
+            update(aDt, aEmitterPos);
+        }
+        return static_cast<unsigned int>(mStorage.aliveCount);
+    }
+
+    // Moves the particles from aFirst on over aCount steps and removes the
+    // ones that die on the way; the particles before aFirst stay put
+    ParticleUpdateParams params = mStepParams.update;
+    params.dt = aDt;
+    const auto advance = [&](std::size_t aFirst, std::uint64_t aCount) {
+        const std::size_t alive = mStorage.aliveCount;
+        mWorkerPool->parallelFor(particleChunkCount(alive - aFirst), [&](std::size_t aChunk) {
+            const std::size_t begin = aFirst + aChunk * cParticleChunkSize;
+            advanceParticles(mStorage, params, aCount, begin, std::min(alive, begin + cParticleChunkSize));
+        });
+        std::size_t i = aFirst;
+        while (i < mStorage.aliveCount)
+        {
+            if (mStorage.life[i] > 0.0f)
+            {
+                ++i;
+                continue;
+            }
+            mStorage.kill(i);
+        }
+    };
+
+    // Emission is limited by the particles alive at each step, so the
+    // steps at which particles die are counted, from their remaining life
+    const float lifeStep = params.lifeDecay * aDt;
+    std::vector<std::size_t> deaths(aSteps, 0);
+    const auto countDeaths = [&](std::size_t aBegin, std::size_t aEnd, std::uint64_t aFirstStep) {
+        if (lifeStep <= 0.0f)
+        {
+            return;
+        }
+        for (std::size_t i = aBegin; i < aEnd; ++i)
+        {
+            const float steps = std::max(std::ceil(mStorage.life[i] / lifeStep), 1.0f);
+            const std::uint64_t lastStep = aFirstStep + static_cast<std::uint64_t>(steps) - 1;
+            if (lastStep < aSteps)
+            {
+                ++deaths[lastStep];
+            }
+        }
+    };
+
+    // The live particles jump to the last step. Then every step emits its
+    // particles with its own random numbers, and they jump to the last step
+    // too; a particle is integrated in the step that emits it.
+    std::size_t aliveAtStep = mStorage.aliveCount;
+    countDeaths(0, aliveAtStep, 0);
+    advance(0, aSteps);
+    for (std::uint64_t step = 0; step < aSteps; ++step)
+    {
+        const std::size_t first = mStorage.aliveCount;
+        const unsigned int emitCount = beginStep(aDt, aEmitterPos);
+        const std::size_t room = mParticleQuota > aliveAtStep ? mParticleQuota - aliveAtStep : 0;
+        const std::size_t emitted = emitParticles(mStorage, std::min<std::size_t>(emitCount, room), mStepParams, *mWorkerPool);
+        countDeaths(first, first + emitted, step);
+        aliveAtStep = aliveAtStep + emitted - deaths[step];
+        advance(first, aSteps - step);
+    }
+    return static_cast<unsigned int>(mStorage.aliveCount);
+}
+
+namespace {
+
+struct SimulationState
+{
+    std::uint64_t capacity;
+    std::uint64_t aliveCount;
+    std::uint64_t particleQuota;
+    std::uint64_t stepIndex;
+    std::uint64_t seed;
+    float emitterPos[3];
+    float dt;
+    float acceleration[3];
+    float lifeDecay;
+    float emissionRate;
+    float emissionAccumulator;
+    std::uint32_t pendingBurst;
+    std::uint32_t streamCount;
+};
+
+} // namespace
+
+bool ParticleSimulation::saveState(std::ostream& aStream) const
+{
+    SimulationState state{};
+    state.capacity = mStorage.count;
+    state.aliveCount = mStorage.aliveCount;
+    state.particleQuota = mParticleQuota;
+    state.stepIndex = mStepIndex;
+    state.seed = mStepParams.seed;
+    for (int i = 0; i < 3; ++i)
+    {
+        state.emitterPos[i] = mStepParams.emitterPos[i];
+        state.acceleration[i] = mStepParams.update.acceleration[i];
+    }
+    state.dt = mStepParams.update.dt;
+    state.lifeDecay = mStepParams.update.lifeDecay;
+    state.emissionRate = mEmitter.rate();
+    state.emissionAccumulator = mEmitter.accumulator();
+    state.pendingBurst = mEmitter.pendingBurst();
+    state.streamCount = static_cast<std::uint32_t>(ParticleStorage::cStreamCount);
+    aStream.write(reinterpret_cast<const char*>(&state), sizeof(state));
+
+    // Only the live particles, one stream after the other
+    for (const float* stream : mStorage.streams())
+    {
+        aStream.write(reinterpret_cast<const char*>(stream), std::streamsize(mStorage.aliveCount * sizeof(float)));
+    }
+    return bool(aStream);
+}
+
+bool ParticleSimulation::loadState(std::istream& aStream)
+{
+    SimulationState state{};
+    if (!aStream.read(reinterpret_cast<char*>(&state), sizeof(state))
+        || state.streamCount != ParticleStorage::cStreamCount
+        || state.capacity != mStorage.count
+        || state.aliveCount > mStorage.count)
+    {
+        return false;
+    }
+
+    const std::size_t alive = static_cast<std::size_t>(state.aliveCount);
+    for (float* stream : mStorage.streams())
+    {
+        if (!aStream.read(reinterpret_cast<char*>(stream), std::streamsize(alive * sizeof(float))))
+        {
+            return false;
+        }
+        // Free and padding slots must have zero life, the rest is cleared too
+        std::fill(stream + alive, stream + mStorage.paddedCount, 0.0f);
+    }
+    mStorage.aliveCount = alive;
+
+    setParticleQuota(static_cast<std::size_t>(state.particleQuota));
+    mStepIndex = state.stepIndex;
+    mStepParams.seed = state.seed;
+    mStepParams.frame = state.stepIndex > 0 ? state.stepIndex - 1 : 0;
+    mStepParams.emitterPos = glm::vec3(state.emitterPos[0], state.emitterPos[1], state.emitterPos[2]);
+    mStepParams.update.dt = state.dt;
+    mStepParams.update.acceleration = glm::vec3(state.acceleration[0], state.acceleration[1], state.acceleration[2]);
+    mStepParams.update.lifeDecay = state.lifeDecay;
+    mEmitter.setRate(state.emissionRate);
+    mEmitter.restore(state.emissionAccumulator, state.pendingBurst);
+    return true;
+}
+
+void reportParticleScaling(std::ostream& aStream, std::size_t aParticleCount, int aSteps)
+{
+    using Clock = std::chrono::steady_clock;
+
+    ParticleStepParams params;
+    params.update.dt = 1.0f / 60.0f;
+    params.seed = 0x5EED;
+
+    // Start from a full pool and emit at the rate that keeps it roughly full.
+    // Initial life averages 1, so a particle lives 1 / lifeDecay seconds.
+    const float meanLifetime = 1.0f / params.update.lifeDecay;
+
+    const unsigned int maxThreads = WorkerPool::defaultThreadCount();
+    std::vector<float> reference;
+    double singleThreadNs = 0.0;
+
+    aStream << "Particle simulation scaling, " << aParticleCount << " particles, "
+        << aSteps << " steps, kernel " << particleKernelName() << "\n";
+    aStream << std::setw(8) << "threads" << std::setw(14) << "ms/step" << std::setw(14) << "ns/particle"
+        << std::setw(10) << "speedup" << std::setw(12) << "identical" << "\n";
+
+    for (unsigned int threads = 1; threads <= maxThreads; ++threads)
+    {
+        WorkerPool pool(threads);
+        ParticleStorage storage;
+        storage.resize(aParticleCount);
+        ParticleEmitter emitter(float(aParticleCount) / meanLifetime);
+        emitter.burst(static_cast<unsigned int>(aParticleCount));
+
+        double totalNs = 0.0;
+        for (int step = 0; step < aSteps; ++step)
+        {
+            params.frame = static_cast<std::uint64_t>(step);
+            const unsigned int emitCount = emitter.takeEmission(params.update.dt);
+            auto start = Clock::now();
+            simulateParticles(storage, params, emitCount, pool);
+            totalNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        }
+
+        const std::size_t floatCount = storage.paddedCount * ParticleStorage::cStreamCount;
+        bool identical = true;
+        if (threads == 1)
+        {
+            reference.assign(storage.positionX, storage.positionX + floatCount);
+            singleThreadNs = totalNs;
+        }
+        else
+        {
+            identical = std::memcmp(reference.data(), storage.positionX, floatCount * sizeof(float)) == 0;
+        }
+
+        const double stepNs = totalNs / aSteps;
+        aStream << std::setw(8) << threads
+            << std::setw(14) << std::fixed << std::setprecision(3) << stepNs * 1e-6
+            << std::setw(14) << std::setprecision(2) << stepNs / double(aParticleCount)
+            << std::setw(10) << std::setprecision(2) << singleThreadNs / totalNs
+            << std::setw(12) << (identical ? "yes" : "NO") << "\n";
+    }
+}
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <limits>
+#include <glm/glm.hpp>
+
+#include "counter_rng.hpp"
+#include "particle_collision.hpp"
+#include "particle_grid.hpp"
+#include "particle_storage.hpp"
+#include "particle_turbulence.hpp"
+#include "particle_kernels.hpp"
+#include "worker_pool.hpp"
+
+// Particles are simulated in fixed-size chunks. A chunk is a whole number of
+// cache lines in every stream, so two threads never write the same line, and
+// its size does not depend on the thread count.
+constexpr std::size_t cParticleChunkSize = 4096;
+static_assert(cParticleChunkSize % cParticleLaneWidth == 0, "Chunks must start on a cache line");
+
+struct ParticleStepParams
+{
+    ParticleUpdateParams update;
+    ParticleSeparationParams separation;
+    ParticleTurbulenceParams turbulence;
+    ParticleCollisionParams collision;
+    glm::vec3 emitterPos = glm::vec3(0.0f);
+    std::uint64_t seed = 0;
+    std::uint64_t frame = 0;
+};
+
+// Turns an emission rate and queued bursts into a whole number of particles
+// per step. The fractional remainder carries over, so low rates still emit.
+class ParticleEmitter
+{
+public:
+    explicit ParticleEmitter(float aRate = 0.0f) : mRate(aRate) {}
+
+    void setRate(float aParticlesPerSecond) { mRate = std::max(aParticlesPerSecond, 0.0f); }
+    float rate() const { return mRate; }
+
+    // Queues particles that are emitted all at once on the next step
+    void burst(unsigned int aCount) { mPendingBurst += aCount; }
+
+    // Emission state between steps, for snapshots
+    float accumulator() const { return mAccumulator; }
+    unsigned int pendingBurst() const { return mPendingBurst; }
+    void restore(float aAccumulator, unsigned int aPendingBurst)
+    {
+        mAccumulator = aAccumulator;
+        mPendingBurst = aPendingBurst;
+    }
+
+    // aRateScale throttles the rate (not the bursts), e.g. for level of detail
+    unsigned int takeEmission(float aDt, float aRateScale = 1.0f)
+    {
+        mAccumulator += mRate * aRateScale * aDt;
+        const unsigned int fromRate = static_cast<unsigned int>(mAccumulator);
+        mAccumulator -= static_cast<float>(fromRate);
+
+        const unsigned int count = fromRate + mPendingBurst;
+        mPendingBurst = 0;
+        return count;
+    }
+
+private:
+    float mRate;
+    float mAccumulator = 0.0f;
+    unsigned int mPendingBurst = 0;
+};
+
+// Splits variable frame times into fixed simulation steps. Leftover time
+// carries over to the next frame; interpolation() is its share of a step,
+// used to blend the last two simulated states for rendering. At most
+// maxSteps() steps run per frame and the rest of a long frame (a hitch, a
+// breakpoint) is dropped, so the effect slows down instead of falling
+// further behind.
+class FixedTimestep
+{
+public:
+    explicit FixedTimestep(float aStepRate = 60.0f, unsigned int aMaxSteps = 4)
+    {
+        setStepRate(aStepRate);
+        setMaxSteps(aMaxSteps);
+    }
+
+    void setStepRate(float aStepsPerSecond) { mStepDuration = 1.0f / std::max(aStepsPerSecond, 1.0f); }
+    float stepRate() const { return 1.0f / mStepDuration; }
+    float stepDuration() const { return mStepDuration; }
+
+    void setMaxSteps(unsigned int aMaxSteps) { mMaxSteps = std::max(aMaxSteps, 1u); }
+    unsigned int maxSteps() const { return mMaxSteps; }
+
+    // Adds the time of one frame and returns the steps to run for it
+    unsigned int advance(float aFrameTime)
+    {
+        mAccumulator += std::max(aFrameTime, 0.0f);
+        unsigned int steps = 0;
+        while (mAccumulator >= mStepDuration && steps < mMaxSteps)
+        {
+            mAccumulator -= mStepDuration;
+            ++steps;
+        }
+        if (mAccumulator >= mStepDuration)
+        {
+            mAccumulator = std::fmod(mAccumulator, mStepDuration);
+        }
+        return steps;
+    }
+
+    // Share of a step that is not simulated yet, in [0, 1)
+    float interpolation() const { return mAccumulator / mStepDuration; }
+
+    // Frame time that is not simulated yet, for snapshots
+    float pendingTime() const { return mAccumulator; }
+    void setPendingTime(float aTime) { mAccumulator = std::max(aTime, 0.0f); }
+
+private:
+    float mStepDuration = 1.0f / 60.0f;
+    float mAccumulator = 0.0f;
+    unsigned int mMaxSteps = 4;
+};
+
+// Axis-aligned box. Empty until the first grow().
+struct ParticleBounds
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    bool empty() const { return min.x > max.x; }
+
+    void grow(glm::vec3 aPoint)
+    {
+        min = glm::min(min, aPoint);
+        max = glm::max(max, aPoint);
+    }
+
+    void grow(const ParticleBounds& aOther)
+    {
+        min = glm::min(min, aOther.min);
+        max = glm::max(max, aOther.max);
+    }
+
+    // Box around the eight transformed corners, so it is conservative for
+    // any rotation
+    ParticleBounds transformed(const glm::mat4& aTransform) const
+    {
+        ParticleBounds result;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            const glm::vec3 point((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+            result.grow(glm::vec3(aTransform * glm::vec4(point, 1.0f)));
+        }
+        return result;
+    }
+
+    // False only if all corners are outside the same clip plane of
+    // aClipFromBox, e.g. projection * view for a world-space box. Boxes
+    // close to a frustum corner may pass although they are outside.
+    bool intersectsFrustum(const glm::mat4& aClipFromBox) const
+    {
+        if (empty())
+        {
+            return false;
+        }
+        int outside[6] = {};
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            const glm::vec3 point((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+            const glm::vec4 clip = aClipFromBox * glm::vec4(point, 1.0f);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                outside[2 * axis] += clip[axis] < -clip.w;
+                outside[2 * axis + 1] += clip[axis] > clip.w;
+            }
+        }
+        return std::none_of(std::begin(outside), std::end(outside), [](int aCount) { return aCount == 8; });
+    }
+};
+
+// Box around the positions of the live particles; empty without any
+ParticleBounds liveParticleBounds(const ParticleStorage& aStorage, WorkerPool& aPool);
+
+// Draws eight values from aRandom, in the same order as particle_emit.compute.glsl
+void respawnParticle(ParticleStorage& aStorage, std::size_t aIndex, glm::vec3 aEmitterPos, CounterRandom& aRandom);
+
+// Appends up to aCount particles behind the live ones; whatever does not fit
+// into the storage is dropped. Returns the number actually emitted.
+std::size_t emitParticles(ParticleStorage& aStorage, std::size_t aCount, const ParticleStepParams& aParams, WorkerPool& aPool);
+
+inline std::size_t particleChunkCount(std::size_t aParticleCount)
+{
+    return (aParticleCount + cParticleChunkSize - 1) / cParticleChunkSize;
+}
+
+// emitParticles() with a custom spawn function, called like respawnParticle()
+template <class SpawnFunction>
+std::size_t emitParticles(ParticleStorage& aStorage, std::size_t aCount, const ParticleStepParams& aParams, WorkerPool& aPool, const SpawnFunction& aSpawn)
+{
+    const std::size_t first = aStorage.aliveCount;
+    const std::size_t emitted = std::min(aCount, aStorage.count - first);
+
+    // Random numbers depend only on the seed, the frame and the particle's
+    // position in this frame's batch, like in particle_emit.compute.glsl
+    const std::uint32_t key = counterRandomKey(aParams.seed);
+    const std::uint32_t frame = static_cast<std::uint32_t>(aParams.frame);
+    aPool.parallelFor(particleChunkCount(emitted), [&](std::size_t aChunk) {
+        const std::size_t end = std::min(emitted, (aChunk + 1) * cParticleChunkSize);
+        for (std::size_t i = aChunk * cParticleChunkSize; i < end; ++i)
+        {
+            CounterRandom random(key, frame, static_cast<std::uint32_t>(i));
+            aSpawn(aStorage, first + i, aParams.emitterPos, random);
+        }
+    });
+
+    aStorage.aliveCount += emitted;
+    return emitted;
+}
+
+// Swap-removes particles whose life ran out so the live ones stay packed in
+// [0, aliveCount). Runs serially, which keeps the resulting order identical
+// for any thread count.
+void compactParticles(ParticleStorage& aStorage);
+
+// Emits aEmitCount particles, integrates all live ones on the worker pool and
+// compacts the pool. Returns the live count after the step. The result is
+// bit-identical for any thread count.
+// With aGrid and a separation radius set, the grid is rebuilt after emission
+// and the separation affector runs before integration. Turbulence and then
+// collision are applied per chunk, right before a chunk is integrated.
+unsigned int simulateParticles(ParticleStorage& aStorage, const ParticleStepParams& aParams, std::size_t aEmitCount, WorkerPool& aPool, ParticleGrid* aGrid = nullptr);
+
+/**
+ * @brief Particle pool, emitter and step state of one effect, without any GL.
+ *
+ * This is the simulation half of ParticleSystem; it can run headless, e.g.
+ * in particles_bench. The GPU and analytic backends only use beginStep() to
+ * get the emission and step parameters; they construct it without storage.
+ */
+class ParticleSimulation
+{
+public:
+    // Without aCpuStorage the storage stays empty and only the emitter, quota
+    // and step parameters are usable; emission is still scaled to
+    // aMaxParticles
+    ParticleSimulation(std::size_t aMaxParticles, std::uint64_t aSeed, bool aCpuStorage = true);
+
+    // Sets up the step parameters and returns the particles to emit this step
+    unsigned int beginStep(float aDt, glm::vec3 aEmitterPos);
+    // beginStep() followed by simulateParticles() on the CPU, or the step of
+    // the effect set with setEffect(). Returns the live count.
+    unsigned int update(float aDt, glm::vec3 aEmitterPos = glm::vec3(0.0f));
+
+    // Runs aSteps steps at once, for a simulation that was paused, e.g.
+    // while off screen; the emitter stays at aEmitterPos. Only the last two
+    // lifetimeSteps() are run: the particles alive at the end are emitted in
+    // the last one, the one before fills the pool as a continuous run would.
+    // Earlier steps only advance the emitter and the step counter. Without an
+    // effect, separation, turbulence and collision the steps are evaluated in
+    // closed form (advanceParticles()) instead of being simulated. Returns
+    // the live count.
+    unsigned int fastForward(std::uint64_t aSteps, float aDt, glm::vec3 aEmitterPos);
+    // Advances the emitter and the step counter by aSteps steps and kills
+    // every particle; the first part of fastForward()
+    void skipSteps(std::uint64_t aSteps, float aDt, glm::vec3 aEmitterPos);
+    // Most steps of length aDt a particle can live, from the largest
+    // initial life the spawner produces
+    std::uint64_t lifetimeSteps(float aDt) const;
+    // True if a step only applies the update parameters, see fastForward()
+    bool isBallistic() const;
+    // Upper bound of the particle scale (ParticleStorage::scale), which
+    // multiplies the drawn quad size
+    float maxParticleScale() const { return mMaxScale; }
+
+    // Replaces emission and update with a ParticleEffect (particle_effect.hpp).
+    // Only the step is called indirectly; the per-particle loop is inlined.
+    // The spawner's lifetime policy must provide maxLife(), its appearance
+    // policy maxSize().
+    template <class Effect>
+    void setEffect(Effect aEffect)
+    {
+        mMaxInitialLife = aEffect.spawner().lifetime.maxLife();
+        mMaxScale = aEffect.spawner().appearance.maxSize();
+        mEffectStep = [effect = std::move(aEffect)](ParticleStorage& aStorage, const ParticleStepParams& aParams, std::size_t aEmitCount, WorkerPool& aPool) {
+            return effect.step(aStorage, aParams, aEmitCount, aPool);
+        };
+    }
+    // Back to respawnParticle() and simulateParticles()
+    void clearEffect();
+    bool hasEffect() const { return static_cast<bool>(mEffectStep); }
+
+    ParticleEmitter& emitter() { return mEmitter; }
+    const ParticleEmitter& emitter() const { return mEmitter; }
+    ParticleStepParams& stepParams() { return mStepParams; }
+    const ParticleStepParams& stepParams() const { return mStepParams; }
+    const ParticleStorage& storage() const { return mStorage; }
+
+    std::size_t maxParticles() const { return mMaxParticles; }
+    std::size_t aliveCount() const { return mStorage.aliveCount; }
+
+    // Upper limit for live particles, at most maxParticles(). Emission is
+    // throttled by quota / capacity and stops at the quota.
+    void setParticleQuota(std::size_t aQuota) { mParticleQuota = std::min(aQuota, mMaxParticles); }
+    std::size_t particleQuota() const { return mParticleQuota; }
+
+    void setWorkerPool(WorkerPool& aPool) { mWorkerPool = &aPool; }
+    WorkerPool& workerPool() const { return *mWorkerPool; }
+
+    // Writes the live particles, the emitter and the step counter, so a
+    // simulation that reads them back continues bit for bit. The update
+    // parameters are stored; fields, effects and the worker pool are
+    // configuration and are not. See particle_snapshot.hpp for the file.
+    bool saveState(std::ostream& aStream) const;
+    // Returns false, and leaves an unspecified state, if the stream is
+    // damaged or was saved with another maxParticles(); emission depends on it
+    bool loadState(std::istream& aStream);
+
+private:
+    ParticleStorage mStorage;
+    ParticleStepParams mStepParams;
+    ParticleEmitter mEmitter;
+    ParticleGrid mGrid;
+    std::size_t mMaxParticles;
+    std::size_t mParticleQuota;
+    std::uint64_t mStepIndex = 0;
+    // Upper bound of the initial life of emitted particles
+    float mMaxInitialLife = 0.0f;
+    float mMaxScale = 0.0f;
+    WorkerPool* mWorkerPool = &WorkerPool::shared();
+    std::function<unsigned int(ParticleStorage&, const ParticleStepParams&, std::size_t, WorkerPool&)> mEffectStep;
+};
+
+// Runs a headless simulation with 1..hardware threads and prints the
+// step time, speedup and whether the state matches the single-threaded run.
+void reportParticleScaling(std::ostream& aStream, std::size_t aParticleCount = 1000000, int aSteps = 60);
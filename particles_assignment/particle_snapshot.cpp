@@ -0,0 +1,299 @@
+#include "particle_snapshot.hpp"
+
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char cSnapshotMagic[8] = { 'P', 'S', 'N', 'P', '0', '0', '0', '1' };
+constexpr char cRecordingMagic[8] = { 'P', 'R', 'E', 'C', '0', '0', '0', '1' };
+
+struct SnapshotHeader
+{
+    char magic[8];
+    float emitterTransform[16];
+    float lastEmitterPos[3];
+    float pendingTime;
+};
+
+// Followed by the frame records, then by frameCount record offsets at tableOffset
+struct RecordingHeader
+{
+    char magic[8];
+    std::uint64_t frameCount;
+    std::uint64_t tableOffset;
+    std::uint64_t instanceSize;
+};
+
+// Followed by count instances. Records are a multiple of 16 bytes, so
+// instances in the mapping are aligned.
+struct FrameHeader
+{
+    std::uint32_t count;
+    float emitterPos[3];
+};
+
+static_assert(sizeof(RecordingHeader) % 16 == 0 && sizeof(FrameHeader) % 16 == 0, "Instances must stay aligned");
+static_assert(sizeof(ParticleInstance) % 16 == 0, "Instances must stay aligned");
+
+} // namespace
+
+bool saveParticleSnapshot(const std::filesystem::path& aPath, const ParticleSimulation& aSimulation, const ParticleSnapshotFrame& aFrame)
+{
+    std::ofstream file(aPath, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    SnapshotHeader header{};
+    std::memcpy(header.magic, cSnapshotMagic, sizeof(cSnapshotMagic));
+    for (int column = 0; column < 4; ++column)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            header.emitterTransform[column * 4 + row] = aFrame.emitterTransform[column][row];
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        header.lastEmitterPos[i] = aFrame.lastEmitterPos[i];
+    }
+    header.pendingTime = aFrame.pendingTime;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return aSimulation.saveState(file) && bool(file);
+}
+
+std::optional<ParticleSnapshotFrame> loadParticleSnapshot(const std::filesystem::path& aPath, ParticleSimulation& aSimulation)
+{
+    std::ifstream file(aPath, std::ios::binary);
+    SnapshotHeader header{};
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, cSnapshotMagic, sizeof(cSnapshotMagic)) != 0
+        || !aSimulation.loadState(file))
+    {
+        return std::nullopt;
+    }
+
+    ParticleSnapshotFrame frame;
+    for (int column = 0; column < 4; ++column)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            frame.emitterTransform[column][row] = header.emitterTransform[column * 4 + row];
+        }
+    }
+    frame.lastEmitterPos = glm::vec3(header.lastEmitterPos[0], header.lastEmitterPos[1], header.lastEmitterPos[2]);
+    frame.pendingTime = header.pendingTime;
+    return frame;
+}
+
+ParticleInstanceRecorder::ParticleInstanceRecorder(const std::filesystem::path& aPath)
+    : mFile(aPath, std::ios::binary)
+{
+    // The header is rewritten with the frame table by finish()
+    RecordingHeader header{};
+    mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+ParticleInstanceRecorder::~ParticleInstanceRecorder()
+{
+    finish();
+}
+
+void ParticleInstanceRecorder::addFrame(const ParticleInstance* aInstances, std::size_t aCount, glm::vec3 aEmitterPos)
+{
+    if (!mFile.is_open())
+    {
+        return;
+    }
+    mFrameOffsets.push_back(static_cast<std::uint64_t>(mFile.tellp()));
+    const FrameHeader header{ static_cast<std::uint32_t>(aCount), { aEmitterPos.x, aEmitterPos.y, aEmitterPos.z } };
+    mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    mFile.write(reinterpret_cast<const char*>(aInstances), std::streamsize(aCount * sizeof(ParticleInstance)));
+}
+
+bool ParticleInstanceRecorder::finish()
+{
+    if (!mFile.is_open())
+    {
+        return false;
+    }
+    RecordingHeader header{};
+    std::memcpy(header.magic, cRecordingMagic, sizeof(cRecordingMagic));
+    header.frameCount = mFrameOffsets.size();
+    header.tableOffset = static_cast<std::uint64_t>(mFile.tellp());
+    header.instanceSize = sizeof(ParticleInstance);
+    mFile.write(reinterpret_cast<const char*>(mFrameOffsets.data()), std::streamsize(mFrameOffsets.size() * sizeof(std::uint64_t)));
+    mFile.seekp(0);
+    mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    const bool written = bool(mFile);
+    mFile.close();
+    return written;
+}
+
+std::optional<ParticleInstanceReplay> ParticleInstanceReplay::open(const std::filesystem::path& aPath)
+{
+    ParticleInstanceReplay replay;
+#ifdef _WIN32
+    HANDLE file = CreateFileW(aPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return std::nullopt;
+    }
+    replay.mFileHandle = file;
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        return std::nullopt;
+    }
+    replay.mMappingHandle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!replay.mMappingHandle)
+    {
+        return std::nullopt;
+    }
+    replay.mData = static_cast<const std::byte*>(MapViewOfFile(replay.mMappingHandle, FILE_MAP_READ, 0, 0, 0));
+    replay.mSize = static_cast<std::size_t>(size.QuadPart);
+#else
+    const int file = ::open(aPath.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        return std::nullopt;
+    }
+    struct stat status{};
+    if (fstat(file, &status) != 0 || status.st_size == 0)
+    {
+        close(file);
+        return std::nullopt;
+    }
+    void* data = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping keeps the file referenced
+    close(file);
+    if (data == MAP_FAILED)
+    {
+        return std::nullopt;
+    }
+    replay.mData = static_cast<const std::byte*>(data);
+    replay.mSize = static_cast<std::size_t>(status.st_size);
+#endif
+    if (!replay.mData || replay.mSize < sizeof(RecordingHeader))
+    {
+        return std::nullopt;
+    }
+
+    RecordingHeader header{};
+    std::memcpy(&header, replay.mData, sizeof(header));
+    const std::uint64_t tableSize = header.frameCount * sizeof(std::uint64_t);
+    if (std::memcmp(header.magic, cRecordingMagic, sizeof(cRecordingMagic)) != 0
+        || header.instanceSize != sizeof(ParticleInstance)
+        || header.tableOffset % sizeof(std::uint64_t) != 0
+        || header.tableOffset > replay.mSize
+        || header.frameCount > (replay.mSize - header.tableOffset) / sizeof(std::uint64_t)
+        || header.tableOffset + tableSize != replay.mSize)
+    {
+        return std::nullopt;
+    }
+    replay.mFrameOffsets = reinterpret_cast<const std::uint64_t*>(replay.mData + header.tableOffset);
+    replay.mFrameCount = static_cast<std::size_t>(header.frameCount);
+
+    // Frames are checked once here, so frame() needs no bounds checks
+    for (std::size_t i = 0; i < replay.mFrameCount; ++i)
+    {
+        const std::uint64_t offset = replay.mFrameOffsets[i];
+        if (offset % 16 != 0 || offset < sizeof(RecordingHeader) || offset + sizeof(FrameHeader) > header.tableOffset)
+        {
+            return std::nullopt;
+        }
+        FrameHeader frame{};
+        std::memcpy(&frame, replay.mData + offset, sizeof(frame));
+        if (offset + sizeof(FrameHeader) + std::uint64_t(frame.count) * sizeof(ParticleInstance) > header.tableOffset)
+        {
+            return std::nullopt;
+        }
+    }
+    return replay;
+}
+
+ParticleInstanceReplay::ParticleInstanceReplay(ParticleInstanceReplay&& aOther) noexcept
+{
+    *this = std::move(aOther);
+}
+
+ParticleInstanceReplay& ParticleInstanceReplay::operator=(ParticleInstanceReplay&& aOther) noexcept
+{
+    if (this != &aOther)
+    {
+        unmap();
+        mData = std::exchange(aOther.mData, nullptr);
+        mSize = std::exchange(aOther.mSize, 0);
+        mFrameOffsets = std::exchange(aOther.mFrameOffsets, nullptr);
+        mFrameCount = std::exchange(aOther.mFrameCount, 0);
+#ifdef _WIN32
+        mFileHandle = std::exchange(aOther.mFileHandle, nullptr);
+        mMappingHandle = std::exchange(aOther.mMappingHandle, nullptr);
+#endif
+    }
+    return *this;
+}
+
+ParticleInstanceReplay::~ParticleInstanceReplay()
+{
+    unmap();
+}
+
+void ParticleInstanceReplay::unmap()
+{
+#ifdef _WIN32
+    if (mData)
+    {
+        UnmapViewOfFile(mData);
+    }
+    if (mMappingHandle)
+    {
+        CloseHandle(mMappingHandle);
+    }
+    if (mFileHandle)
+    {
+        CloseHandle(mFileHandle);
+    }
+    mFileHandle = nullptr;
+    mMappingHandle = nullptr;
+#else
+    if (mData)
+    {
+        munmap(const_cast<std::byte*>(mData), mSize);
+    }
+#endif
+    mData = nullptr;
+    mSize = 0;
+    mFrameOffsets = nullptr;
+    mFrameCount = 0;
+}
+
+ParticleReplayFrame ParticleInstanceReplay::frame(std::size_t aIndex) const
+{
+    FrameHeader header{};
+    const std::byte* record = mData + mFrameOffsets[aIndex];
+    std::memcpy(&header, record, sizeof(header));
+
+    ParticleReplayFrame frame;
+    frame.instances = reinterpret_cast<const ParticleInstance*>(record + sizeof(FrameHeader));
+    frame.count = header.count;
+    frame.emitterPos = glm::vec3(header.emitterPos[0], header.emitterPos[1], header.emitterPos[2]);
+    return frame;
+}
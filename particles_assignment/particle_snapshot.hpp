@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particle_kernels.hpp"
+#include "particle_simulation.hpp"
+
+// Frame state of the owner of a simulation, stored next to it in a snapshot
+struct ParticleSnapshotFrame
+{
+    // Transform of the emitter, e.g. the ParticleSystem model matrix
+    glm::mat4 emitterTransform = glm::mat4(1.0f);
+    // Emitter position of the last frame, see ParticleSystem::update()
+    glm::vec3 lastEmitterPos = glm::vec3(0.0f);
+    // Frame time not simulated yet, see FixedTimestep
+    float pendingTime = 0.0f;
+};
+
+// Writes the full state of aSimulation (ParticleSimulation::saveState())
+// and aFrame to a binary file. Returns false if it could not be written.
+bool saveParticleSnapshot(const std::filesystem::path& aPath, const ParticleSimulation& aSimulation, const ParticleSnapshotFrame& aFrame);
+// Restores aSimulation and returns the frame state. Empty if the file is
+// missing or damaged, or does not fit aSimulation.
+std::optional<ParticleSnapshotFrame> loadParticleSnapshot(const std::filesystem::path& aPath, ParticleSimulation& aSimulation);
+
+/**
+ * @brief Writes the instances drawn each frame to a replay file.
+ *
+ * Every frame is a record of its instance count, the emitter position the
+ * instances are relative to and the packed ParticleInstance array. A table
+ * of record offsets at the end lets ParticleInstanceReplay find frames
+ * without reading the file.
+ */
+class ParticleInstanceRecorder
+{
+public:
+    explicit ParticleInstanceRecorder(const std::filesystem::path& aPath);
+    ~ParticleInstanceRecorder();
+
+    ParticleInstanceRecorder(const ParticleInstanceRecorder&) = delete;
+    ParticleInstanceRecorder& operator=(const ParticleInstanceRecorder&) = delete;
+
+    bool isOpen() const { return mFile.is_open(); }
+    std::size_t frameCount() const { return mFrameOffsets.size(); }
+
+    void addFrame(const ParticleInstance* aInstances, std::size_t aCount, glm::vec3 aEmitterPos);
+    // Writes the frame table and closes the file; also done by the
+    // destructor. Returns false if any write failed.
+    bool finish();
+
+private:
+    std::ofstream mFile;
+    std::vector<std::uint64_t> mFrameOffsets;
+};
+
+struct ParticleReplayFrame
+{
+    const ParticleInstance* instances = nullptr;
+    std::size_t count = 0;
+    glm::vec3 emitterPos = glm::vec3(0.0f);
+};
+
+/**
+ * @brief Read-only memory mapping of a file written by ParticleInstanceRecorder.
+ *
+ * Frames point straight into the mapping, so playing one back is a single
+ * copy into the instance buffer and no simulation or packing runs. The
+ * operating system pages the file in on demand.
+ */
+class ParticleInstanceReplay
+{
+public:
+    // Empty if the file is missing, damaged or cannot be mapped
+    static std::optional<ParticleInstanceReplay> open(const std::filesystem::path& aPath);
+
+    ParticleInstanceReplay(ParticleInstanceReplay&& aOther) noexcept;
+    ParticleInstanceReplay& operator=(ParticleInstanceReplay&& aOther) noexcept;
+    ~ParticleInstanceReplay();
+
+    std::size_t frameCount() const { return mFrameCount; }
+    ParticleReplayFrame frame(std::size_t aIndex) const;
+
+private:
+    ParticleInstanceReplay() = default;
+    void unmap();
+
+    const std::byte* mData = nullptr;
+    std::size_t mSize = 0;
+    const std::uint64_t* mFrameOffsets = nullptr;
+    std::size_t mFrameCount = 0;
+#ifdef _WIN32
+    void* mFileHandle = nullptr;
+    void* mMappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,85 @@
+#include "particle_sort.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+// Keys have at most 16 bits. Small systems use fewer buckets (about four per
+// particle), so clearing and scanning the histogram does not dominate.
+constexpr std::size_t cMaxDepthBuckets = std::size_t(std::numeric_limits<std::uint16_t>::max()) + 1;
+constexpr std::size_t cMinDepthBuckets = 256;
+
+static std::size_t depthBucketCount(std::size_t aParticleCount)
+{
+    return std::clamp(std::bit_ceil(aParticleCount) * 4, cMinDepthBuckets, cMaxDepthBuckets);
+}
+
+const std::vector<std::uint32_t>& ParticleDepthSorter::sort(const ParticleStorage& aStorage, const glm::vec4& aDepthRow)
+{
+    computeKeys(aStorage, aDepthRow);
+    repairOrder(aStorage.aliveCount);
+
+    // Histogram -> exclusive prefix sum -> stable scatter in the previous order
+    mBucketOffsets.assign(depthBucketCount(mKeys.size()), 0);
+    for (std::uint16_t key : mKeys)
+    {
+        ++mBucketOffsets[key];
+    }
+    std::uint32_t sum = 0;
+    for (std::uint32_t& offset : mBucketOffsets)
+    {
+        const std::uint32_t count = offset;
+        offset = sum;
+        sum += count;
+    }
+
+    mScratch.resize(mOrder.size());
+    for (std::uint32_t index : mOrder)
+    {
+        mScratch[mBucketOffsets[mKeys[index]]++] = index;
+    }
+    mOrder.swap(mScratch);
+    return mOrder;
+}
+
+void ParticleDepthSorter::computeKeys(const ParticleStorage& aStorage, const glm::vec4& aDepthRow)
+{
+    const std::size_t alive = aStorage.aliveCount;
+    mDepths.resize(alive);
+    mKeys.resize(alive);
+
+    float nearest = -std::numeric_limits<float>::max();
+    float farthest = std::numeric_limits<float>::max();
+    for (std::size_t i = 0; i < alive; ++i)
+    {
+        // The camera looks down -z, so the farthest particle has the smallest z
+        const float depth = aDepthRow.x * aStorage.positionX[i] + aDepthRow.y * aStorage.positionY[i]
+            + aDepthRow.z * aStorage.positionZ[i] + aDepthRow.w;
+        mDepths[i] = depth;
+        nearest = std::max(nearest, depth);
+        farthest = std::min(farthest, depth);
+    }
+
+    const float range = nearest - farthest;
+    const float scale = range > 0.0f ? float(depthBucketCount(alive) - 1) / range : 0.0f;
+    for (std::size_t i = 0; i < alive; ++i)
+    {
+        mKeys[i] = static_cast<std::uint16_t>((mDepths[i] - farthest) * scale);
+    }
+}
+
+void ParticleDepthSorter::repairOrder(std::size_t aAliveCount)
+{
+    // Compaction only moves particles into lower slots: indices past the live
+    // count are gone and slots the old order did not cover hold new particles.
+    // A slot that now holds a different particle keeps its old place in the
+    // input, which only matters for ties.
+    const std::size_t previousCount = mOrder.size();
+    mOrder.erase(
+        std::remove_if(mOrder.begin(), mOrder.end(), [aAliveCount](std::uint32_t aIndex) { return aIndex >= aAliveCount; }),
+        mOrder.end());
+    for (std::size_t i = previousCount; i < aAliveCount; ++i)
+    {
+        mOrder.push_back(static_cast<std::uint32_t>(i));
+    }
+}
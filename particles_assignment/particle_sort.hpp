@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particle_storage.hpp"
+
+/**
+ * @brief Back-to-front order of the live particles, for blend modes that
+ * are not order independent.
+ *
+ * View depth is quantized to 16 bits over the depth range of the system and
+ * sorted with a single stable counting pass (a one-digit radix sort). The
+ * pass walks the order of the previous frame, so particles with equal keys
+ * keep their relative order instead of flickering, and the scatter writes
+ * are mostly sequential because the previous order is nearly sorted.
+ */
+class ParticleDepthSorter
+{
+public:
+    // aDepthRow is the third row of the model-view matrix, so the view-space
+    // z of a particle is dot(aDepthRow, vec4(position, 1)).
+    const std::vector<std::uint32_t>& sort(const ParticleStorage& aStorage, const glm::vec4& aDepthRow);
+
+    // Particle indices, farthest first
+    const std::vector<std::uint32_t>& order() const { return mOrder; }
+
+private:
+    void computeKeys(const ParticleStorage& aStorage, const glm::vec4& aDepthRow);
+    void repairOrder(std::size_t aAliveCount);
+
+    std::vector<std::uint32_t> mOrder;
+    std::vector<std::uint32_t> mScratch;
+    std::vector<float> mDepths;
+    // Quantized depth per particle index, ascending from the farthest particle
+    std::vector<std::uint16_t> mKeys;
+    std::vector<std::uint32_t> mBucketOffsets;
+};
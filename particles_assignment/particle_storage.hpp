@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <array>
+
+// Every stream starts on a cache line and is padded to a whole number of
+// SIMD lanes, so the update kernels never need a scalar tail loop.
+constexpr std::size_t cParticleStreamAlignment = 64;
+constexpr std::size_t cParticleLaneWidth = 16;
+
+struct AlignedFloatDeleter
+{
+    void operator()(float* aPtr) const
+    {
+        ::operator delete[](aPtr, std::align_val_t(cParticleStreamAlignment));
+    }
+};
+
+using AlignedFloatArray = std::unique_ptr<float[], AlignedFloatDeleter>;
+
+inline AlignedFloatArray allocateAlignedFloats(std::size_t aCount)
+{
+    float* ptr = static_cast<float*>(::operator new[](aCount * sizeof(float), std::align_val_t(cParticleStreamAlignment)));
+    std::fill(ptr, ptr + aCount, 0.0f);
+    return AlignedFloatArray(ptr);
+}
+
+/**
+ * @brief Structure-of-arrays particle state.
+ *
+ * All streams live in one aligned allocation. Live particles are kept packed
+ * in [0, aliveCount); slots behind them are free. Slots past `count` (the
+ * SIMD padding) always have zero life, so kernels treat them as dead.
+ */
+struct ParticleStorage
+{
+    float* positionX = nullptr;
+    float* positionY = nullptr;
+    float* positionZ = nullptr;
+    float* velocityX = nullptr;
+    float* velocityY = nullptr;
+    float* velocityZ = nullptr;
+    float* life = nullptr;
+    float* initialLife = nullptr;
+    float* scale = nullptr;
+    float* colorR = nullptr;
+    float* colorG = nullptr;
+    float* colorB = nullptr;
+    float* colorA = nullptr;
+    // Position before the last step, for render interpolation
+    float* previousX = nullptr;
+    float* previousY = nullptr;
+    float* previousZ = nullptr;
+
+    std::size_t count = 0;
+    std::size_t paddedCount = 0;
+    std::size_t aliveCount = 0;
+
+    static constexpr std::size_t cStreamCount = 16;
+
+    std::array<float*, cStreamCount> streams() const
+    {
+        return {
+            positionX, positionY, positionZ,
+            velocityX, velocityY, velocityZ,
+            life, initialLife, scale,
+            colorR, colorG, colorB, colorA,
+            previousX, previousY, previousZ
+        };
+    }
+
+    // Swap-remove: the last live particle takes the place of aIndex.
+    void kill(std::size_t aIndex)
+    {
+        const std::size_t last = --aliveCount;
+        for (float* stream : streams())
+        {
+            stream[aIndex] = stream[last];
+        }
+        life[last] = 0.0f;
+    }
+
+    void resize(std::size_t aCount)
+    {
+        count = aCount;
+        aliveCount = 0;
+        paddedCount = (aCount + cParticleLaneWidth - 1) / cParticleLaneWidth * cParticleLaneWidth;
+        mBlock = allocateAlignedFloats(paddedCount * cStreamCount);
+
+        float** streams[cStreamCount] = {
+            &positionX, &positionY, &positionZ,
+            &velocityX, &velocityY, &velocityZ,
+            &life, &initialLife, &scale,
+            &colorR, &colorG, &colorB, &colorA,
+            &previousX, &previousY, &previousZ
+        };
+        for (std::size_t i = 0; i < cStreamCount; ++i)
+        {
+            *streams[i] = mBlock.get() + i * paddedCount;
+        }
+    }
+
+private:
+    AlignedFloatArray mBlock;
+};
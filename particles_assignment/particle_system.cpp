@@ -7,88 +7,195 @@
 #include <ogl_geometry_factory.hpp>
 #include "vertex.hpp"
 #include <array>
+#include <cmath>
+#include <cstring>
 #include <memory>
 
 #include <vector>
 #include "mesh_object.hpp"
 #include "ogl_geometry_construction.hpp"
+#include <glm/gtc/quaternion.hpp>
 
 
-ParticleSystem::ParticleSystem(unsigned int amount)
-    : mMaxParticles(amount), m_randomGen(std::random_device{}())
+// The billboard quad is drawn as a 4 vertex triangle strip
+constexpr unsigned int cParticleQuadVertexCount = 4;
+constexpr float cParticleQuadHalfSize = 0.15f;
+// Particle scale drawn at cParticleQuadHalfSize, that of the fire spawner;
+// the quad grows in proportion to ParticleStorage::scale
+constexpr float cParticleReferenceScale = 0.05f;
+// Shader storage binding of the particle data read by particle.vertex.glsl
+constexpr GLuint cParticleDataBinding = 0;
+
+static_assert(sizeof(ParticleInstance) == cGpuParticleInstanceWords * sizeof(std::uint32_t),
+    "particle_pack.compute.glsl writes tightly packed instances");
+
+ParticleSystem::ParticleSystem(unsigned int amount, ParticleBackend backend)
+    // Only the CPU backend simulates into the SoA storage
+    : mSimulation(amount, std::random_device{}(), backend == ParticleBackend::Cpu)
+    , mBackend(backend)
+    , mMaxParticles(amount)
 {
-    mParticles.resize(mMaxParticles);
-    for (auto& p : mParticles)
-    {
-        p.mLife = 0.0f;
+    if (mBackend == ParticleBackend::Gpu) {
+        mGpuSimulation = std::make_unique<GpuParticleSimulation>(mMaxParticles, cParticleQuadVertexCount);
+        mGeometry = std::make_shared<OGLGeometry>(generateParticleBuffers(mGpuSimulation->instanceBuffer()));
+        mGeometry->buffer.indirectBuffer = mGpuSimulation->drawCommandBuffer();
+        return;
+    }
+    if (mBackend == ParticleBackend::Analytic) {
+        // Zeroed slots have no life and are culled by the vertex shader
+        const std::vector<AnalyticParticle> empty(mMaxParticles, AnalyticParticle{});
+        mAnalyticRing = createBuffer();
+        GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, mAnalyticRing.get()));
+        GL_CHECK(glBufferData(GL_ARRAY_BUFFER, empty.size() * sizeof(AnalyticParticle), empty.data(), GL_DYNAMIC_DRAW));
+        mGeometry = std::make_shared<OGLGeometry>(generateParticleBuffers(mAnalyticRing.get()));
+        return;
     }
-    mBuffers = generateParticleBuffers(mParticles);
+
+    mInstanceRing = std::make_unique<PersistentRingBuffer<3>>(mMaxParticles * sizeof(ParticleInstance));
+    mGeometry = std::make_shared<OGLGeometry>(generateParticleBuffers(mInstanceRing->get()));
+    uploadInstances(1.0f);
 }
 
 void ParticleSystem::update(float dt, glm::vec3 emitterPos)
 {
-    int activeParticles = 0;
-    
-    for (auto& p : mParticles)
-    {
-        if (p.mLife > 0.0f)
-        {
-            float lifeNorm = p.mLife / p.mInitialLife;
-            // white -> yellow -> orange -> red
-            glm::vec3 white = glm::vec3(1.0f, 1.0f, 1.0f);
-            glm::vec3 yellow = glm::vec3(1.0f, 1.0f, 0.0f);
-            glm::vec3 orange = glm::vec3(1.0f, 0.5f, 0.0f);
-            glm::vec3 red = glm::vec3(1.0f, 0.1f, 0.0f);
-            glm::vec3 color;
-            if (lifeNorm > 0.75f) {
-                float t = (lifeNorm - 0.75f) / 0.25f;
-                color = glm::mix(yellow, white, t); // white to yellow
-            } else if (lifeNorm > 0.5f) {
-                float t = (lifeNorm - 0.5f) / 0.25f;
-                color = glm::mix(orange, yellow, t); // yellow to orange
-            } else {
-                float t = lifeNorm / 0.5f;
-                color = glm::mix(red, orange, t); // orange to red
-            }
-            p.mColor = glm::vec4(color, lifeNorm); // alpha fades out
-
-            p.mPosition += p.mVelocity * dt;
-            p.mVelocity += glm::vec3(0.0f, 0.2f, 0.0f) * dt; // Reduced gravity
-            p.mLife -= dt * 1.5f;
-            p.mColor.a = std::max(0.0f, p.mColor.a - dt * 2.5f); // Prevent negative alpha
-            
-            activeParticles++;
-        }
-        else
-        {
-            respawnParticle(p, emitterPos);
-        }
+    if (mReplay) {
+        replayFrame();
+        return;
     }
-    
-    if (activeParticles > 0) {
-        for (auto& mode : mRenderInfos) {
-            mode.second.geometry = std::make_shared<OGLGeometry>(generateParticleBuffers(mParticles));
-        }
+
+    if (!mHasEmitterPos) {
+        mLastEmitterPos = emitterPos;
+        mHasEmitterPos = true;
     }
+
+    const unsigned int steps = mTimestep.advance(dt);
+    // Off screen the steps are only counted, the fixed step grid stays the same
+    mSuspended = mOffscreenSuspension && mBackend != ParticleBackend::Gpu && mHasCamera
+        && !worldBounds(emitterPos).intersectsFrustum(mProjectionMatrix * mViewMatrix);
+    if (mSuspended) {
+        mSkippedSteps += steps;
+        mLastEmitterPos = emitterPos;
+        return;
+    }
+    if (mSkippedSteps > 0) {
+        catchUp(emitterPos);
+        mLastEmitterPos = emitterPos;
+    }
+
+    for (unsigned int step = 1; step <= steps; ++step) {
+        simulateStep(glm::mix(mLastEmitterPos, emitterPos, float(step) / float(steps)));
+    }
+    mLastEmitterPos = emitterPos;
+
+    if (mBackend == ParticleBackend::Cpu && steps > 0 && mSimulation.aliveCount() > 0) {
+        // Grow-only, so the bounds approach the whole extent of the effect
+        ParticleBounds live = liveParticleBounds(mSimulation.storage(), mSimulation.workerPool());
+        const glm::vec3 emitter = mSimulation.stepParams().emitterPos;
+        live.min -= emitter;
+        live.max -= emitter;
+        mLocalBounds = getLocalBounds();
+        mLocalBounds.grow(live);
+    }
+
+    // Instances are packed every frame, also without a step, as the
+    // interpolation moves on. They are relative to the emitter of the last step.
+    const float interpolation = mTimestep.interpolation();
+    const glm::vec3 origin = mSimulation.stepParams().emitterPos;
+    if (mBackend == ParticleBackend::Gpu) {
+        mGpuSimulation->packInstances(interpolation, origin, getCulling());
+        mGeometry->buffer.indirectBuffer = mGpuSimulation->drawCommandBuffer();
+    }
+    else if (mBackend == ParticleBackend::Analytic) {
+        setAnalyticParameters(interpolation);
+    }
+    else if (mInWorld) {
+        // ParticleWorld::update() packs the particles
+    }
+    else if (mSimulation.aliveCount() > 0) {
+        uploadInstances(interpolation);
+    }
+    else if (mRecorder) {
+        mRecorder->addFrame(nullptr, 0, origin);
+    }
+    setEmitterPosition(origin);
+}
+
+void ParticleSystem::simulateStep(glm::vec3 emitterPos)
+{
+    const float dt = mTimestep.stepDuration();
+    if (mBackend == ParticleBackend::Gpu) {
+        // The emit shader clamps to the quota, the live count is not known here
+        const unsigned int emitCount = mSimulation.beginStep(dt, emitterPos);
+        mGpuSimulation->setParticleQuota(getParticleQuota());
+        mGpuSimulation->step(mSimulation.stepParams(), emitCount);
+        return;
+    }
+    if (mBackend == ParticleBackend::Analytic) {
+        // Emitting more than the ring holds would overwrite this step's own particles
+        const std::size_t emitCount = std::min<std::size_t>(mSimulation.beginStep(dt, emitterPos), mMaxParticles);
+        mAnalyticSpawns.resize(emitCount);
+        spawnAnalyticParticles(mAnalyticScratch, emitCount, mSimulation.stepParams(), mSimulation.workerPool(), mAnalyticSpawns.data());
+        uploadAnalyticParticles(emitCount);
+        return;
+    }
+    mSimulation.update(dt, emitterPos);
+}
+
+float ParticleSystem::getParticleSize()
+{
+    return 2.0f * cParticleQuadHalfSize;
+}
+
+float ParticleSystem::getQuadHalfSizePerScale()
+{
+    return cParticleQuadHalfSize / cParticleReferenceScale;
+}
+
+std::optional<RenderData> ParticleSystem::getRenderData(const RenderOptions& options) const
+{
+    // An instance count of zero would make OGLGeometry fall back to a plain
+    // draw. The GPU backend draws indirectly, where an empty pool draws nothing.
+    if (mSuspended || mInWorld) {
+        return std::optional<RenderData>();
+    }
+    const std::size_t drawn = mReplay || mBackend == ParticleBackend::Analytic ? mGeometry->buffer.instanceCount : mSimulation.aliveCount();
+    if (mBackend != ParticleBackend::Gpu && drawn == 0) {
+        return std::optional<RenderData>();
+    }
+    return MeshObject::getRenderData(options);
 }
 
 std::shared_ptr<AGeometry> ParticleSystem::getGeometry(GeometryFactory& aGeometryFactory, RenderStyle aRenderStyle)
 {
-    return std::make_shared<OGLGeometry>(generateParticleBuffers(mParticles));
+    return mGeometry;
 }
 
 void ParticleSystem::prepareRenderData(MaterialFactory& matFactory, GeometryFactory& geoFactory)
 {
+    if (mGpuSimulation) {
+        mGpuSimulation->loadPrograms(matFactory);
+    }
+    setLifeCurveParameters();
     for (auto& mode : mRenderInfos)
     {
+        // Set by every system, the program is shared
+        mode.second.materialParams.mParameterValues["u_analytic"] = int(mBackend == ParticleBackend::Analytic);
+        mode.second.materialParams.mParameterValues["u_sharedPool"] = 0;
+        mode.second.materialParams.mParameterValues.try_emplace("u_lightingMode", int(ParticleLighting::Fragment));
+        mode.second.materialParams.mParameterValues["u_ambientSH[0]"] = ArrayDescription{ 12, mAmbientLight.coefficients().data() };
+        mode.second.materialParams.mParameterValues["u_quadHalfSize"] = getQuadHalfSizePerScale();
+        mode.second.materialParams.mParameterValues["u_firstInstance"] = mInstanceRing ? static_cast<unsigned>(mInstanceRing->currentRegion() * mMaxParticles) : 0u;
         mode.second.shaderProgram = matFactory.getShaderProgram(mode.second.materialParams.mMaterialName);
         getTextures(mode.second.materialParams.mParameterValues, matFactory);
         mode.second.geometry = getGeometry(geoFactory, mode.second.materialParams.mRenderStyle);
     }
 }
 
-void ParticleSystem::updateCameraVectors(const glm::mat4& viewMatrix)
+void ParticleSystem::updateCameraVectors(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix)
 {
+    mViewMatrix = viewMatrix;
+    mProjectionMatrix = projectionMatrix;
+    mHasCamera = true;
     glm::vec3 cameraRight = glm::normalize(glm::vec3(viewMatrix[0][0], viewMatrix[1][0], viewMatrix[2][0]));
     glm::vec3 cameraUp = glm::normalize(glm::vec3(viewMatrix[0][1], viewMatrix[1][1], viewMatrix[2][1]));
 
@@ -98,105 +205,291 @@ void ParticleSystem::updateCameraVectors(const glm::mat4& viewMatrix)
         {
             mode.second.materialParams.mParameterValues["u_cameraRight"] = cameraRight;
             mode.second.materialParams.mParameterValues["u_cameraUp"] = cameraUp;
+            mode.second.materialParams.mParameterValues["u_sizeScale"] = mSizeScale;
         }
     }
 }
 
-unsigned int ParticleSystem::firstUnusedParticle()
+float ParticleSystem::getQuadRadius() const
 {
-    for (unsigned int i = mLastUsedParticle; i < mMaxParticles; ++i)
-    {
-        if (mParticles[i].mLife <= 0.0f)
-        {
-            mLastUsedParticle = i;
-            return i;
+    // The quad corners are the furthest points from the particle, at the
+    // largest size over life and the largest particle scale
+    const auto& sizes = mLifeCurves.sizeSamples();
+    const float maxLifeSize = *std::max_element(sizes.begin(), sizes.end());
+    return std::sqrt(2.0f) * getQuadHalfSizePerScale() * mSimulation.maxParticleScale() * mSizeScale * maxLifeSize;
+}
+
+GpuParticleCulling ParticleSystem::getCulling() const
+{
+    GpuParticleCulling culling;
+    culling.enabled = mHasCamera;
+    culling.clipFromSimulation = mProjectionMatrix * mViewMatrix * getModelMatrix();
+    culling.radius = getQuadRadius();
+    return culling;
+}
+
+ParticleBounds ParticleSystem::getLocalBounds() const
+{
+    if (!mLocalBounds.empty()) {
+        return mLocalBounds;
+    }
+    ParticleBounds bounds;
+    bounds.grow(glm::vec3(-mBoundingRadius));
+    bounds.grow(glm::vec3(mBoundingRadius));
+    return bounds;
+}
+
+ParticleBounds ParticleSystem::worldBounds(glm::vec3 emitterPos) const
+{
+    ParticleBounds bounds = getLocalBounds();
+    const float radius = getQuadRadius();
+    bounds.min += emitterPos - glm::vec3(radius);
+    bounds.max += emitterPos + glm::vec3(radius);
+    return bounds.transformed(getModelMatrix());
+}
+
+void ParticleSystem::catchUp(glm::vec3 emitterPos)
+{
+    const float dt = mTimestep.stepDuration();
+    if (mBackend == ParticleBackend::Cpu) {
+        mSimulation.fastForward(mSkippedSteps, dt, emitterPos);
+    }
+    else {
+        // Analytic: only particles that can still be alive need a record
+        const std::uint64_t lifetime = mSimulation.lifetimeSteps(dt);
+        if (mSkippedSteps > lifetime) {
+            mSimulation.skipSteps(mSkippedSteps - lifetime, dt, emitterPos);
+            mSkippedSteps = lifetime;
         }
+        for (; mSkippedSteps > 0; --mSkippedSteps) {
+            simulateStep(emitterPos);
+        }
+    }
+    mSkippedSteps = 0;
+}
+
+void ParticleSystem::setEmitterPosition(glm::vec3 emitterPos)
+{
+    // Instance positions are relative to the emitter of the step that wrote them
+    for (auto& mode : mRenderInfos)
+    {
+        mode.second.materialParams.mParameterValues["u_emitterPos"] = emitterPos;
     }
-    for (unsigned int i = 0; i < mLastUsedParticle; ++i)
+}
+
+void ParticleSystem::setFirstInstance(unsigned int firstInstance)
+{
+    for (auto& mode : mRenderInfos)
     {
-        if (mParticles[i].mLife <= 0.0f)
-        {
-            mLastUsedParticle = i;
-            return i;
-        }
+        mode.second.materialParams.mParameterValues["u_firstInstance"] = firstInstance;
     }
-    mLastUsedParticle = 0;
-    return 0;
 }
 
-void ParticleSystem::respawnParticle(Particle& p, glm::vec3 emitterPos)
+void ParticleSystem::uploadAnalyticParticles(std::size_t count)
 {
-    // Generate random angle and radius for circular distribution
-    float angle = m_dist(m_randomGen) * 2.0f * 3.14159f; 
-    float radius = m_dist(m_randomGen) * 0.5f;  
-    
-    float x = radius * cos(angle);
-    float y = radius * sin(angle);
-    
-    float z = m_dist(m_randomGen) * 0.5f; 
+    // Written once per particle; the ring wraps at most once per step
+    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, mAnalyticRing.get()));
+    std::size_t written = 0;
+    while (written < count) {
+        const std::size_t run = std::min(count - written, mMaxParticles - mAnalyticHead);
+        GL_CHECK(glBufferSubData(GL_ARRAY_BUFFER, mAnalyticHead * sizeof(AnalyticParticle), run * sizeof(AnalyticParticle), mAnalyticSpawns.data() + written));
+        mAnalyticHead = (mAnalyticHead + run) % mMaxParticles;
+        written += run;
+    }
+    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
 
-    p.mPosition = emitterPos + glm::vec3(x, y, z);
+    // Slots are drawn once written; dead ones are culled in the vertex shader
+    mAnalyticWritten = std::min<std::size_t>(mAnalyticWritten + count, mMaxParticles);
+    mGeometry->buffer.instanceCount = static_cast<unsigned>(mAnalyticWritten);
+}
 
-    p.mVelocity = glm::vec3(
-        float((rand() % 200) - 100) * 0.001f,  
-        1.8f + m_dist(m_randomGen) * 0.7f,    
-        float((rand() % 200) - 100) * 0.002f  
-    );
+void ParticleSystem::setAnalyticParameters(float interpolation)
+{
+    // Time is passed as the last step and a fraction of a step, as a float
+    // time in seconds would lose precision over a long session
+    const ParticleStepParams& params = mSimulation.stepParams();
+    for (auto& mode : mRenderInfos)
+    {
+        MaterialParameterValues& values = mode.second.materialParams.mParameterValues;
+        values["u_step"] = static_cast<unsigned int>(params.frame);
+        values["u_stepFraction"] = interpolation;
+        values["u_stepDuration"] = mTimestep.stepDuration();
+        values["u_acceleration"] = params.update.acceleration;
+        values["u_lifeDecay"] = params.update.lifeDecay;
+    }
+}
 
-    p.mInitialLife = p.mLife = 1.0f + m_dist(m_randomGen) * 0.7f;
-    p.mScale = 0.05f + m_dist(m_randomGen) * 0.02f;
+void ParticleSystem::setTurbulence(std::shared_ptr<const CurlNoiseField> field, float strength, float frequency)
+{
+    mTurbulenceField = std::move(field);
+    ParticleTurbulenceParams& turbulence = mSimulation.stepParams().turbulence;
+    turbulence.field = mTurbulenceField.get();
+    turbulence.strength = strength;
+    turbulence.frequency = frequency;
 }
 
-IndexedBuffer ParticleSystem::generateParticleBuffers(const std::vector<Particle>& particles)
+void ParticleSystem::setCollider(std::shared_ptr<const MeshDistanceField> field, const glm::mat4& fieldToLocal, float radius, float restitution, float friction)
 {
-    IndexedBuffer buffers{ createVertexArray() };
-    buffers.vbos.reserve(3);
+    mCollisionField = std::move(field);
+    ParticleCollisionParams& collision = mSimulation.stepParams().collision;
+    collision.field = mCollisionField.get();
+    collision.setTransform(fieldToLocal);
+    collision.radius = radius;
+    collision.restitution = restitution;
+    collision.friction = friction;
+}
 
-    float particleSize = 0.15f;
-    std::vector<VertexNormTex> vertices = {
-        VertexNormTex(glm::vec3( particleSize,  particleSize, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(1.0f, 1.0f)),
-        VertexNormTex(glm::vec3(-particleSize,  particleSize, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f, 1.0f)),
-        VertexNormTex(glm::vec3( particleSize, -particleSize, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(1.0f, 0.0f)),
-        VertexNormTex(glm::vec3(-particleSize, -particleSize, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f, 0.0f))
-    };
+void ParticleSystem::setColorOverLife(std::vector<ParticleColorKey> keys)
+{
+    mLifeCurves.setColorKeys(std::move(keys));
+}
 
-    std::vector<unsigned int> indices = { 0, 1, 2, 3 };
+void ParticleSystem::setSizeOverLife(std::vector<ParticleSizeKey> keys)
+{
+    mLifeCurves.setSizeKeys(std::move(keys));
+}
 
-    GL_CHECK(glBindVertexArray(buffers.vao.get()));
+void ParticleSystem::setLifeCurveParameters()
+{
+    // Arrays are listed under the name of their first element. The samples
+    // are read when the uniforms are set, so later curve changes apply too.
+    const ArrayDescription colors{ static_cast<int>(mLifeCurves.colorSamples().size()), mLifeCurves.colorSamples().data() };
+    const ArrayDescription sizes{ static_cast<int>(mLifeCurves.sizeSamples().size()), mLifeCurves.sizeSamples().data() };
+    for (auto& mode : mRenderInfos)
+    {
+        mode.second.materialParams.mParameterValues["u_colorOverLife[0]"] = colors;
+        mode.second.materialParams.mParameterValues["u_sizeOverLife[0]"] = sizes;
+    }
+}
 
-    buffers.vbos.push_back(createBuffer());
-    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, buffers.vbos[0].get()));
-    GL_CHECK(glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexNormTex), vertices.data(), GL_STATIC_DRAW));
+void ParticleSystem::uploadInstances(float interpolation)
+{
+    // Only the live particles at the front of the pool are packed and drawn
+    const ParticleStorage& particles = mSimulation.storage();
+    const std::size_t alive = particles.aliveCount;
 
-    buffers.vbos.push_back(createBuffer());
-    GL_CHECK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.vbos[1].get()));
-    GL_CHECK(glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW));
+    const std::uint32_t* order = nullptr;
+    if (mDepthSorting) {
+        const glm::mat4 modelView = mViewMatrix * getModelMatrix();
+        const glm::vec4 depthRow(modelView[0][2], modelView[1][2], modelView[2][2], modelView[3][2]);
+        order = mDepthSorter.sort(particles, depthRow).data();
+    }
 
-    GL_CHECK(glEnableVertexAttribArray(0));
-    GL_CHECK(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexNormTex), (void*)0));
+    auto* region = static_cast<ParticleInstance*>(mInstanceRing->acquireNextRegion());
+    ParticleInstance* instances = region;
+    if (mRecorder) {
+        mRecordedInstances.resize(alive);
+        instances = mRecordedInstances.data();
+    }
+    const glm::vec3 origin = mSimulation.stepParams().emitterPos;
+    mSimulation.workerPool().parallelFor(particleChunkCount(alive), [&](std::size_t chunk) {
+        const std::size_t begin = chunk * cParticleChunkSize;
+        packParticleInstances(particles, order, begin, std::min(alive, begin + cParticleChunkSize), origin, interpolation, instances);
+    });
+    if (mRecorder) {
+        std::memcpy(region, instances, alive * sizeof(ParticleInstance));
+        mRecorder->addFrame(instances, alive, origin);
+    }
+
+    // The vertex shader reads the current region from u_firstInstance on;
+    // gl_InstanceID does not include the base instance of a draw.
+    mGeometry->buffer.instanceCount = static_cast<unsigned>(alive);
+    setFirstInstance(static_cast<unsigned>(mInstanceRing->currentRegion() * mMaxParticles));
+}
+
+void ParticleSystem::replayFrame()
+{
+    const ParticleReplayFrame frame = mReplay->frame(mReplayFrame);
+    mReplayFrame = (mReplayFrame + 1) % mReplay->frameCount();
+
+    // Straight from the file mapping into the instance buffer
+    const std::size_t count = std::min<std::size_t>(frame.count, mMaxParticles);
+    void* region = mInstanceRing->acquireNextRegion();
+    std::memcpy(region, frame.instances, count * sizeof(ParticleInstance));
+    mGeometry->buffer.instanceCount = static_cast<unsigned>(count);
+    setFirstInstance(static_cast<unsigned>(mInstanceRing->currentRegion() * mMaxParticles));
+    setEmitterPosition(frame.emitterPos);
+}
+
+bool ParticleSystem::saveSnapshot(const std::filesystem::path& path) const
+{
+    if (mBackend != ParticleBackend::Cpu) {
+        return false;
+    }
+    ParticleSnapshotFrame frame;
+    frame.emitterTransform = getModelMatrix();
+    frame.lastEmitterPos = mLastEmitterPos;
+    frame.pendingTime = mTimestep.pendingTime();
+    return saveParticleSnapshot(path, mSimulation, frame);
+}
+
+bool ParticleSystem::loadSnapshot(const std::filesystem::path& path)
+{
+    if (mBackend != ParticleBackend::Cpu) {
+        return false;
+    }
+    const std::optional<ParticleSnapshotFrame> frame = loadParticleSnapshot(path, mSimulation);
+    if (!frame) {
+        return false;
+    }
 
-    GL_CHECK(glEnableVertexAttribArray(1));
-    GL_CHECK(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexNormTex), (void*)(sizeof(glm::vec3))));
+    // The model matrix is translation * rotation * scale, without shear
+    const glm::mat4& transform = frame->emitterTransform;
+    const glm::vec3 scale(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])));
+    setPosition(glm::vec3(transform[3]));
+    setRotation(glm::quat_cast(glm::mat3(glm::vec3(transform[0]) / scale.x, glm::vec3(transform[1]) / scale.y, glm::vec3(transform[2]) / scale.z)));
+    setScale(scale);
 
-    GL_CHECK(glEnableVertexAttribArray(2));
-    GL_CHECK(glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertexNormTex), (void*)(2*sizeof(glm::vec3))));
+    mLastEmitterPos = frame->lastEmitterPos;
+    mHasEmitterPos = true;
+    mTimestep.setPendingTime(frame->pendingTime);
+    // Steps skipped off screen belong to the replaced state
+    mSkippedSteps = 0;
+    mSuspended = false;
+    if (mSimulation.aliveCount() > 0) {
+        uploadInstances(mTimestep.interpolation());
+    }
+    setEmitterPosition(mSimulation.stepParams().emitterPos);
+    return true;
+}
 
-    buffers.vbos.push_back(createBuffer());
-    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, buffers.vbos[2].get()));
-    GL_CHECK(glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_DYNAMIC_DRAW));
+bool ParticleSystem::startRecording(const std::filesystem::path& path)
+{
+    if (mBackend != ParticleBackend::Cpu || mInWorld) {
+        return false;
+    }
+    mRecorder = std::make_unique<ParticleInstanceRecorder>(path);
+    if (!mRecorder->isOpen()) {
+        mRecorder.reset();
+        return false;
+    }
+    return true;
+}
 
-    GL_CHECK(glEnableVertexAttribArray(3));
-    GL_CHECK(glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, mPosition)));
-    GL_CHECK(glVertexAttribDivisor(3, 1));
+void ParticleSystem::stopRecording()
+{
+    mRecorder.reset();
+    mRecordedInstances = std::vector<ParticleInstance>();
+}
 
-    GL_CHECK(glEnableVertexAttribArray(4));
-    GL_CHECK(glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, mColor)));
-    GL_CHECK(glVertexAttribDivisor(4, 1));
+void ParticleSystem::setReplay(std::shared_ptr<const ParticleInstanceReplay> replay)
+{
+    if (mBackend != ParticleBackend::Cpu || mInWorld || (replay && replay->frameCount() == 0)) {
+        replay.reset();
+    }
+    mReplay = std::move(replay);
+    mReplayFrame = 0;
+}
 
+IndexedBuffer ParticleSystem::generateParticleBuffers(GLuint particleBuffer)
+{
+    // Vertex pulling: the VAO is empty, particle.vertex.glsl builds the quad
+    // corners from gl_VertexID and reads the particles from the buffer
+    IndexedBuffer buffers{ createVertexArray() };
+    buffers.indexed = false;
     buffers.mode = GL_TRIANGLE_STRIP;
-    buffers.indexCount = static_cast<unsigned>(indices.size());
-    buffers.instanceCount = static_cast<unsigned>(particles.size());
-    
-    GL_CHECK(glBindVertexArray(0));
+    buffers.indexCount = cParticleQuadVertexCount;
+    buffers.storageBuffer = particleBuffer;
+    buffers.storageBinding = cParticleDataBinding;
     return buffers;
-}
\ No newline at end of file
+}
@@ -2,46 +2,246 @@
 
 #include "mesh_object.hpp"
 #include "ogl_geometry_construction.hpp"
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <glm/glm.hpp>
 #include <random>
 #include "vertex.hpp"
+#include "ogl_geometry_factory.hpp"
+#include "persistent_ring_buffer.hpp"
+#include "particle_storage.hpp"
+#include "particle_kernels.hpp"
+#include "particle_simulation.hpp"
+#include "particle_effect.hpp"
+#include "gpu_particle_simulation.hpp"
+#include "particle_sort.hpp"
+#include "particle_curves.hpp"
+#include "particle_snapshot.hpp"
+#include "particle_analytic.hpp"
+#include "particle_lighting.hpp"
+
+enum class ParticleBackend
+{
+    Cpu,     // SoA storage simulated on the worker pool, streamed to the GPU every frame
+    Gpu,     // State stays in shader storage buffers, drawn indirectly
+    Analytic // Only spawn records are uploaded; the vertex shader evaluates the ballistic motion
+};
 
 class ParticleSystem : public MeshObject
 {
 public:
-    struct Particle
-    {
-        glm::vec3 mPosition;
-        glm::vec3 mVelocity;
-        glm::vec4 mColor;
-        float mLife;
-        float mScale;
-        float mInitialLife;
-    };
-
-    explicit ParticleSystem(unsigned int amount = 1000);
+    explicit ParticleSystem(unsigned int amount = 1000, ParticleBackend backend = ParticleBackend::Cpu);
 
+    // Advances the simulation by the frame time dt in fixed steps, see
+    // setSimulationRate(), and prepares the interpolated particles for drawing
     void update(float dt, glm::vec3 emitterPos = glm::vec3(0.0f));
-    void updateCameraVectors(const glm::mat4& viewMatrix);
+    // Call before update(). The depth sort uses the view matrix given here,
+    // the GPU backend culls particles outside the view frustum.
+    void updateCameraVectors(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix);
     std::shared_ptr<AGeometry> getGeometry(GeometryFactory& factory, RenderStyle style) override;
     void prepareRenderData(MaterialFactory& matFactory, GeometryFactory& geoFactory) override;
+    // Nothing is drawn while the pool is empty
+    std::optional<RenderData> getRenderData(const RenderOptions& options) const override;
+
+    // Particles emitted per second; defaults to the rate that keeps the pool full
+    void setEmissionRate(float particlesPerSecond) { mSimulation.emitter().setRate(particlesPerSecond); }
+    float getEmissionRate() const { return mSimulation.emitter().rate(); }
+    // Emits count particles at once on the next update, as far as the pool has room
+    void burst(unsigned int count) { mSimulation.emitter().burst(count); }
+
+    // CPU backend only; the GPU backend keeps its live count on the GPU, the
+    // analytic backend never knows it
+    unsigned int getAliveCount() const { return static_cast<unsigned int>(mSimulation.aliveCount()); }
+    unsigned int getMaxParticles() const { return mMaxParticles; }
+
+    // Upper limit for live particles, at most getMaxParticles(). Emission is
+    // throttled by quota / capacity; particles above the quota die out.
+    void setParticleQuota(unsigned int quota) { mSimulation.setParticleQuota(quota); }
+    unsigned int getParticleQuota() const { return static_cast<unsigned int>(mSimulation.particleQuota()); }
+
+    // Fixed simulation steps per second and the most steps run in one
+    // update(); the rest of a longer frame is dropped. Drawing interpolates
+    // between the last two steps, so rates below the display rate still move
+    // smoothly. Defaults to 60 steps per second and 4 steps per frame.
+    void setSimulationRate(float stepsPerSecond, unsigned int maxStepsPerFrame = 4)
+    {
+        mTimestep.setStepRate(stepsPerSecond);
+        mTimestep.setMaxSteps(maxStepsPerFrame);
+    }
+    float getSimulationRate() const { return mTimestep.stepRate(); }
+
+    // Scales the rendered particle quads
+    void setParticleSizeScale(float scale) { mSizeScale = scale; }
+    float getParticleSizeScale() const { return mSizeScale; }
+    // World-space edge length of a particle quad at size scale 1, for the
+    // particle scale 0.05 of the fire spawner
+    static float getParticleSize();
+    // u_quadHalfSize: half edge length per unit of particle scale, see
+    // ParticleStorage::scale
+    static float getQuadHalfSizePerScale();
+    // Blend between the last two steps that drawing uses, see setSimulationRate()
+    float getInterpolation() const { return mTimestep.interpolation(); }
+
+    // Color (multiplied with the particle tint) and quad size over the
+    // normalized particle age, evaluated by the vertex shader
+    void setColorOverLife(std::vector<ParticleColorKey> keys);
+    void setSizeOverLife(std::vector<ParticleSizeKey> keys);
+    const ParticleLifeCurves& getLifeCurves() const { return mLifeCurves; }
+
+    // Ambient light of materials with the u_lightingMode parameter
+    // ParticleLighting::Vertex; the default matches the Phong ambient
+    void setAmbientLight(const ParticleAmbientSH& ambient) { mAmbientLight = ambient; }
+    const ParticleAmbientSH& getAmbientLight() const { return mAmbientLight; }
 
-    IndexedBuffer mBuffers;
-    GLuint m_instanceVBO;
-    std::mt19937 m_randomGen;
-    std::uniform_real_distribution<float> m_dist{ -0.5f, 0.5f };
+    // Radius around the emitter that contains the effect, used for level of detail
+    void setBoundingRadius(float radius) { mBoundingRadius = radius; }
+    float getBoundingRadius() const { return mBoundingRadius; }
+
+    // Box that contains the particles, in simulation units relative to the
+    // emitter. Defaults to a cube of getBoundingRadius(); the CPU backend
+    // grows it to the particles it simulates.
+    void setLocalBounds(const ParticleBounds& bounds) { mLocalBounds = bounds; }
+    ParticleBounds getLocalBounds() const;
+    // Conservative world-space box of the particle quads
+    ParticleBounds getWorldBounds() const { return worldBounds(mLastEmitterPos); }
+
+    // Stops simulating while getWorldBounds() is outside the view frustum
+    // given to updateCameraVectors(). When it comes back the skipped steps
+    // are caught up at once, see ParticleSimulation::fastForward(), so the
+    // effect looks as if it never stopped. On by default; CPU and analytic
+    // backends, the GPU backend culls when drawing.
+    void setOffscreenSuspension(bool enabled) { mOffscreenSuspension = enabled; }
+    bool getOffscreenSuspension() const { return mOffscreenSuspension; }
+    bool isSuspended() const { return mSuspended; }
+
+    // Draws particles back to front, needed for blend modes that are not
+    // additive. CPU backend only.
+    void setDepthSorting(bool enabled) { mDepthSorting = enabled; }
+    bool getDepthSorting() const { return mDepthSorting; }
+    ParticleBackend getBackend() const { return mBackend; }
+
+    // Pushes particles closer than radius apart, for dense smoke. A radius
+    // of 0 (the default) disables it. CPU backend only. Costs about 0.27 us
+    // per live particle and thread on the sandbox Xeon with few neighbors,
+    // rising to about 0.5 us when the candidate cap of 64 is reached.
+    void setSeparation(float radius, float strength)
+    {
+        mSimulation.stepParams().separation.radius = radius;
+        mSimulation.stepParams().separation.strength = strength;
+    }
+    const ParticleSeparationParams& getSeparation() const { return mSimulation.stepParams().separation; }
+
+    // Swirls particles with a baked curl-noise field; frequency is in field
+    // tiles per world unit. A null field disables it. CPU and GPU backends.
+    void setTurbulence(std::shared_ptr<const CurlNoiseField> field, float strength, float frequency = 0.5f);
+    const ParticleTurbulenceParams& getTurbulence() const { return mSimulation.stepParams().turbulence; }
+
+    // Bounces particles off a baked mesh. fieldToLocal maps mesh coordinates
+    // into this system's simulation space, e.g.
+    // inverse(getModelMatrix()) * mesh->getModelMatrix(). A null field
+    // disables it. CPU backend only.
+    void setCollider(std::shared_ptr<const MeshDistanceField> field, const glm::mat4& fieldToLocal, float radius = 0.02f, float restitution = 0.3f, float friction = 0.1f);
+    const ParticleCollisionParams& getCollision() const { return mSimulation.stepParams().collision; }
+
+    // Replaces the built-in emitter and update with a ParticleEffect from
+    // particle_effect.hpp. CPU backend only.
+    template <class Effect>
+    void setEffect(Effect effect) { mSimulation.setEffect(std::move(effect)); }
+
+    // Writes the particles, emitter, step counter and transform to a binary
+    // file, see particle_snapshot.hpp. CPU backend only.
+    bool saveSnapshot(const std::filesystem::path& path) const;
+    // Continues exactly where saveSnapshot() stopped and restores the
+    // transform. Fails if the snapshot has another getMaxParticles().
+    bool loadSnapshot(const std::filesystem::path& path);
+
+    // Writes the instances drawn each update to a replay file, until
+    // stopRecording(). CPU backend outside a ParticleWorld only.
+    bool startRecording(const std::filesystem::path& path);
+    void stopRecording();
+    bool isRecording() const { return static_cast<bool>(mRecorder); }
+
+    // Draws the recorded frames in a loop, one per update, instead of
+    // simulating, e.g. to time rendering alone. Null goes back to the
+    // simulation. CPU backend outside a ParticleWorld only.
+    void setReplay(std::shared_ptr<const ParticleInstanceReplay> replay);
+    bool isReplaying() const { return static_cast<bool>(mReplay); }
+
+    // Worker pool used for simulation and instance packing, defaults to WorkerPool::shared()
+    void setWorkerPool(WorkerPool& pool) { mSimulation.setWorkerPool(pool); }
+
+    // GL-free simulation state, CPU backend
+    const ParticleSimulation& getSimulation() const { return mSimulation; }
+
+    // Set by ParticleWorld: the system only simulates, the world packs and
+    // draws its particles together with the other members
+    void setInWorld(bool inWorld) { mInWorld = inWorld; }
+    bool isInWorld() const { return mInWorld; }
+
+    // Empty VAO drawing one billboard per instance, the particles are read
+    // by particle.vertex.glsl from particleBuffer
+    static IndexedBuffer generateParticleBuffers(GLuint particleBuffer);
 
 private:
-    void init();
+    void simulateStep(glm::vec3 emitterPos);
+    void uploadInstances(float interpolation);
+    void replayFrame();
+    void setEmitterPosition(glm::vec3 emitterPos);
+    void setFirstInstance(unsigned int firstInstance);
+    void uploadAnalyticParticles(std::size_t count);
+    void catchUp(glm::vec3 emitterPos);
+    ParticleBounds worldBounds(glm::vec3 emitterPos) const;
+    float getQuadRadius() const;
+    void setAnalyticParameters(float interpolation);
+    void setLifeCurveParameters();
+    GpuParticleCulling getCulling() const;
 
-    static IndexedBuffer generateParticleBuffers(const std::vector<Particle>& particles);
+    ParticleSimulation mSimulation;
+    FixedTimestep mTimestep;
+    // Emitter position of the previous update, the steps of a frame move
+    // the emitter from there
+    glm::vec3 mLastEmitterPos = glm::vec3(0.0f);
+    bool mHasEmitterPos = false;
+    ParticleDepthSorter mDepthSorter;
+    ParticleLifeCurves mLifeCurves;
+    ParticleAmbientSH mAmbientLight;
+    // Keeps the field referenced by the step parameters alive
+    std::shared_ptr<const CurlNoiseField> mTurbulenceField;
+    std::shared_ptr<const MeshDistanceField> mCollisionField;
+    bool mDepthSorting = false;
+    glm::mat4 mViewMatrix = glm::mat4(1.0f);
+    glm::mat4 mProjectionMatrix = glm::mat4(1.0f);
+    bool mHasCamera = false;
+    float mSizeScale = 1.0f;
+    float mBoundingRadius = 1.0f;
+    // Empty until set or grown, see getLocalBounds()
+    ParticleBounds mLocalBounds;
+    bool mOffscreenSuspension = true;
+    bool mSuspended = false;
+    std::uint64_t mSkippedSteps = 0;
+    bool mInWorld = false;
 
-    std::vector<Particle> mParticles;
-    unsigned int mMaxParticles;
-    unsigned int mLastUsedParticle = 0;
+    ParticleBackend mBackend;
+    std::unique_ptr<GpuParticleSimulation> mGpuSimulation;
 
-    unsigned int firstUnusedParticle();
-    void respawnParticle(Particle& particle, glm::vec3 emitterPos);
+    // Analytic backend: spawn records in a ring of getMaxParticles() slots,
+    // the oldest are overwritten. Spawning fills the scratch storage first.
+    OpenGLResource mAnalyticRing;
+    std::size_t mAnalyticHead = 0;
+    std::size_t mAnalyticWritten = 0;
+    ParticleStorage mAnalyticScratch;
+    std::vector<AnalyticParticle> mAnalyticSpawns;
+
+    std::unique_ptr<ParticleInstanceRecorder> mRecorder;
+    // The mapped ring is write-only, recorded frames are packed here first
+    std::vector<ParticleInstance> mRecordedInstances;
+    std::shared_ptr<const ParticleInstanceReplay> mReplay;
+    std::size_t mReplayFrame = 0;
+
+    // CPU backend instance data streams through a triple-buffered persistently
+    // mapped buffer; the quad geometry and VAO are created once.
+    std::unique_ptr<PersistentRingBuffer<3>> mInstanceRing;
+    std::shared_ptr<OGLGeometry> mGeometry;
+    unsigned int mMaxParticles;
 };
\ No newline at end of file
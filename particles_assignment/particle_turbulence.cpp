@@ -0,0 +1,232 @@
+#include "particle_turbulence.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "counter_rng.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define PARTICLE_TURBULENCE_SSE 1
+    #include <xmmintrin.h>
+    #include <emmintrin.h>
+#endif
+
+namespace {
+
+// Periodic value noise in [-1, 1] with aPeriod cells per tile
+float periodicValueNoise(glm::vec3 aPosition, std::uint32_t aPeriod, std::uint32_t aKey)
+{
+    const glm::vec3 cell = aPosition * float(aPeriod);
+    const glm::vec3 base = glm::floor(cell);
+    const glm::vec3 t = cell - base;
+    // Quintic fade, continuous second derivative at the lattice points
+    const glm::vec3 fade = t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+
+    auto lattice = [&](int aX, int aY, int aZ) {
+        const std::uint32_t x = std::uint32_t(int(base.x) + aX) % aPeriod;
+        const std::uint32_t y = std::uint32_t(int(base.y) + aY) % aPeriod;
+        const std::uint32_t z = std::uint32_t(int(base.z) + aZ) % aPeriod;
+        const std::uint32_t hash = counterHash(aKey ^ counterHash(x + aPeriod * (y + aPeriod * z)));
+        return float(hash >> 8) * (2.0f / 16777216.0f) - 1.0f;
+    };
+
+    const float x00 = glm::mix(lattice(0, 0, 0), lattice(1, 0, 0), fade.x);
+    const float x10 = glm::mix(lattice(0, 1, 0), lattice(1, 1, 0), fade.x);
+    const float x01 = glm::mix(lattice(0, 0, 1), lattice(1, 0, 1), fade.x);
+    const float x11 = glm::mix(lattice(0, 1, 1), lattice(1, 1, 1), fade.x);
+    return glm::mix(glm::mix(x00, x10, fade.y), glm::mix(x01, x11, fade.y), fade.z);
+}
+
+} // namespace
+
+CurlNoiseField::CurlNoiseField(std::size_t aResolution, std::size_t aLatticePeriod, std::uint32_t aSeed)
+    : mResolution(aResolution)
+{
+    if (aResolution < 2 || (aResolution & (aResolution - 1)) != 0)
+    {
+        throw std::invalid_argument("Curl noise resolution must be a power of two");
+    }
+
+    const std::size_t n = aResolution;
+    const std::size_t voxelCount = n * n * n;
+    auto index = [n](std::size_t aX, std::size_t aY, std::size_t aZ) {
+        return ((aZ % n) * n + (aY % n)) * n + (aX % n);
+    };
+
+    // Vector potential at the voxel centers, two octaves per component
+    std::vector<glm::vec3> potential(voxelCount);
+    const std::uint32_t period = static_cast<std::uint32_t>(aLatticePeriod);
+    for (std::size_t z = 0; z < n; ++z)
+    {
+        for (std::size_t y = 0; y < n; ++y)
+        {
+            for (std::size_t x = 0; x < n; ++x)
+            {
+                const glm::vec3 position = (glm::vec3(float(x), float(y), float(z)) + 0.5f) / float(n);
+                glm::vec3 value;
+                for (int c = 0; c < 3; ++c)
+                {
+                    const std::uint32_t key = counterHash(aSeed + std::uint32_t(c));
+                    value[c] = periodicValueNoise(position, period, key)
+                        + 0.5f * periodicValueNoise(position, 2 * period, counterHash(key));
+                }
+                potential[index(x, y, z)] = value;
+            }
+        }
+    }
+
+    // Curl by central differences; the grid wraps, so the field tiles
+    mVoxels = allocateAlignedFloats(voxelCount * 4);
+    float maxLength = 0.0f;
+    for (std::size_t z = 0; z < n; ++z)
+    {
+        for (std::size_t y = 0; y < n; ++y)
+        {
+            for (std::size_t x = 0; x < n; ++x)
+            {
+                const glm::vec3 dx = potential[index(x + 1, y, z)] - potential[index(x + n - 1, y, z)];
+                const glm::vec3 dy = potential[index(x, y + 1, z)] - potential[index(x, y + n - 1, z)];
+                const glm::vec3 dz = potential[index(x, y, z + 1)] - potential[index(x, y, z + n - 1)];
+                const glm::vec3 curl(dy.z - dz.y, dz.x - dx.z, dx.y - dy.x);
+
+                float* voxel = mVoxels.get() + 4 * index(x, y, z);
+                voxel[0] = curl.x;
+                voxel[1] = curl.y;
+                voxel[2] = curl.z;
+                maxLength = std::max(maxLength, glm::length(curl));
+            }
+        }
+    }
+
+    const float normalization = maxLength > 0.0f ? 1.0f / maxLength : 0.0f;
+    for (std::size_t i = 0; i < voxelCount * 4; ++i)
+    {
+        mVoxels[i] *= normalization;
+    }
+}
+
+glm::vec3 CurlNoiseField::sample(glm::vec3 aPosition) const
+{
+    const std::size_t mask = mResolution - 1;
+    const glm::vec3 texel = aPosition * float(mResolution) - 0.5f;
+    const glm::vec3 base = glm::floor(texel);
+    const glm::vec3 t = texel - base;
+    const std::size_t x0 = std::size_t(std::int64_t(base.x)) & mask;
+    const std::size_t y0 = std::size_t(std::int64_t(base.y)) & mask;
+    const std::size_t z0 = std::size_t(std::int64_t(base.z)) & mask;
+    const std::size_t x1 = (x0 + 1) & mask;
+    const std::size_t y1 = (y0 + 1) & mask;
+    const std::size_t z1 = (z0 + 1) & mask;
+
+    auto voxel = [&](std::size_t aX, std::size_t aY, std::size_t aZ) {
+        const float* v = mVoxels.get() + 4 * ((aZ * mResolution + aY) * mResolution + aX);
+        return glm::vec3(v[0], v[1], v[2]);
+    };
+    const glm::vec3 c00 = glm::mix(voxel(x0, y0, z0), voxel(x1, y0, z0), t.x);
+    const glm::vec3 c10 = glm::mix(voxel(x0, y1, z0), voxel(x1, y1, z0), t.x);
+    const glm::vec3 c01 = glm::mix(voxel(x0, y0, z1), voxel(x1, y0, z1), t.x);
+    const glm::vec3 c11 = glm::mix(voxel(x0, y1, z1), voxel(x1, y1, z1), t.x);
+    return glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z);
+}
+
+void applyParticleTurbulence(ParticleStorage& aStorage, const ParticleTurbulenceParams& aParams, float aDt, std::size_t aBegin, std::size_t aEnd)
+{
+    if (!aParams.field || aParams.strength == 0.0f)
+    {
+        return;
+    }
+    const CurlNoiseField& field = *aParams.field;
+    const float impulse = aParams.strength * aDt;
+
+#if PARTICLE_TURBULENCE_SSE
+    // Four particles at a time: the texel coordinates are computed in SIMD,
+    // then each particle's blend runs on whole voxels, one register each.
+    const std::size_t resolution = field.resolution();
+    const float scale = aParams.frequency * float(resolution);
+    const float* voxels = field.voxels();
+    const __m128i mask = _mm_set1_epi32(int(resolution - 1));
+    const __m128 scaleVector = _mm_set1_ps(scale);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 impulseVector = _mm_set1_ps(impulse);
+
+    auto lerp = [](__m128 aFrom, __m128 aTo, __m128 aT) {
+        return _mm_add_ps(aFrom, _mm_mul_ps(_mm_sub_ps(aTo, aFrom), aT));
+    };
+    // floor() for SSE2: truncate, then step down where that rounded up
+    auto texel = [&](const float* aPosition, __m128& aFraction) {
+        const __m128 u = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(aPosition), scaleVector), half);
+        __m128 base = _mm_cvtepi32_ps(_mm_cvttps_epi32(u));
+        base = _mm_sub_ps(base, _mm_and_ps(_mm_cmpgt_ps(base, u), one));
+        aFraction = _mm_sub_ps(u, base);
+        return _mm_and_si128(_mm_cvttps_epi32(base), mask);
+    };
+
+    std::size_t i = aBegin;
+    for (; i + 4 <= aEnd; i += 4)
+    {
+        __m128 tx4, ty4, tz4;
+        alignas(16) std::int32_t x0[4], y0[4], z0[4];
+        alignas(16) float fx[4], fy[4], fz[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(x0), texel(aStorage.positionX + i, tx4));
+        _mm_store_si128(reinterpret_cast<__m128i*>(y0), texel(aStorage.positionY + i, ty4));
+        _mm_store_si128(reinterpret_cast<__m128i*>(z0), texel(aStorage.positionZ + i, tz4));
+        _mm_store_ps(fx, tx4);
+        _mm_store_ps(fy, ty4);
+        _mm_store_ps(fz, tz4);
+
+        __m128 delta[4];
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            const std::size_t wrap = resolution - 1;
+            const std::size_t x = std::size_t(x0[lane]);
+            const std::size_t y = std::size_t(y0[lane]);
+            const std::size_t z = std::size_t(z0[lane]);
+            const std::size_t x1 = (x + 1) & wrap;
+            const std::size_t y1 = (y + 1) & wrap;
+            const std::size_t z1 = (z + 1) & wrap;
+            const std::size_t row0 = (z * resolution + y) * resolution;
+            const std::size_t row1 = (z * resolution + y1) * resolution;
+            const std::size_t row2 = (z1 * resolution + y) * resolution;
+            const std::size_t row3 = (z1 * resolution + y1) * resolution;
+
+            const __m128 tx = _mm_set1_ps(fx[lane]);
+            const __m128 ty = _mm_set1_ps(fy[lane]);
+            const __m128 tz = _mm_set1_ps(fz[lane]);
+            const __m128 c00 = lerp(_mm_load_ps(voxels + 4 * (row0 + x)), _mm_load_ps(voxels + 4 * (row0 + x1)), tx);
+            const __m128 c10 = lerp(_mm_load_ps(voxels + 4 * (row1 + x)), _mm_load_ps(voxels + 4 * (row1 + x1)), tx);
+            const __m128 c01 = lerp(_mm_load_ps(voxels + 4 * (row2 + x)), _mm_load_ps(voxels + 4 * (row2 + x1)), tx);
+            const __m128 c11 = lerp(_mm_load_ps(voxels + 4 * (row3 + x)), _mm_load_ps(voxels + 4 * (row3 + x1)), tx);
+            delta[lane] = lerp(lerp(c00, c10, ty), lerp(c01, c11, ty), tz);
+        }
+
+        // Back to SoA; the fourth row is the unused w channel
+        _MM_TRANSPOSE4_PS(delta[0], delta[1], delta[2], delta[3]);
+        float* velocityX = aStorage.velocityX + i;
+        float* velocityY = aStorage.velocityY + i;
+        float* velocityZ = aStorage.velocityZ + i;
+        _mm_storeu_ps(velocityX, _mm_add_ps(_mm_loadu_ps(velocityX), _mm_mul_ps(delta[0], impulseVector)));
+        _mm_storeu_ps(velocityY, _mm_add_ps(_mm_loadu_ps(velocityY), _mm_mul_ps(delta[1], impulseVector)));
+        _mm_storeu_ps(velocityZ, _mm_add_ps(_mm_loadu_ps(velocityZ), _mm_mul_ps(delta[2], impulseVector)));
+    }
+    for (; i < aEnd; ++i)
+    {
+        const glm::vec3 position(aStorage.positionX[i], aStorage.positionY[i], aStorage.positionZ[i]);
+        const glm::vec3 velocity = field.sample(position * aParams.frequency) * impulse;
+        aStorage.velocityX[i] += velocity.x;
+        aStorage.velocityY[i] += velocity.y;
+        aStorage.velocityZ[i] += velocity.z;
+    }
+#else
+    for (std::size_t i = aBegin; i < aEnd; ++i)
+    {
+        const glm::vec3 position(aStorage.positionX[i], aStorage.positionY[i], aStorage.positionZ[i]);
+        const glm::vec3 velocity = field.sample(position * aParams.frequency) * impulse;
+        aStorage.velocityX[i] += velocity.x;
+        aStorage.velocityY[i] += velocity.y;
+        aStorage.velocityZ[i] += velocity.z;
+    }
+#endif
+}
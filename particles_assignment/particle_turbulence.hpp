@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "particle_storage.hpp"
+
+/**
+ * @brief Tileable, approximately divergence-free velocity field baked on a
+ * periodic grid.
+ *
+ * The field is the discrete curl of a baked vector potential made of
+ * periodic value noise, so it swirls with hardly any sources or sinks. Its
+ * central differences only cancel on the grid; trilinear samples between
+ * voxels keep a small divergence. One voxel is stored as four floats
+ * (xyz and a zero), which is one SSE register on the CPU and one RGBA texel
+ * of the GL_TEXTURE_3D used by the GPU backend. Coordinates are in field
+ * units: one unit is one tile, and the field repeats in every direction.
+ */
+class CurlNoiseField
+{
+public:
+    // aResolution must be a power of two. aLatticePeriod noise cells span one
+    // tile; a second octave adds detail at twice the frequency.
+    explicit CurlNoiseField(std::size_t aResolution = 32, std::size_t aLatticePeriod = 4, std::uint32_t aSeed = 0x7C0FFEEu);
+
+    std::size_t resolution() const { return mResolution; }
+    // mResolution^3 voxels, four floats each, x fastest
+    const float* voxels() const { return mVoxels.get(); }
+
+    // Trilinear sample with texel centers at (i + 0.5) / resolution, like
+    // texture() on a GL_LINEAR, GL_REPEAT 3D texture. Largest magnitude is
+    // about 1.
+    glm::vec3 sample(glm::vec3 aPosition) const;
+
+private:
+    std::size_t mResolution;
+    AlignedFloatArray mVoxels;
+};
+
+struct ParticleTurbulenceParams
+{
+    // Not owned; null disables the affector
+    const CurlNoiseField* field = nullptr;
+    // Velocity change per second at the field's largest magnitude
+    float strength = 0.0f;
+    // Field tiles per world unit
+    float frequency = 0.5f;
+};
+
+// Adds the field velocity to the live particles in [aBegin, aEnd)
+void applyParticleTurbulence(ParticleStorage& aStorage, const ParticleTurbulenceParams& aParams, float aDt, std::size_t aBegin, std::size_t aEnd);
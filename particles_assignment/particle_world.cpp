@@ -0,0 +1,169 @@
+#include "particle_world.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+ParticleWorld::ParticleWorld()
+    : mWorkerPool(&WorkerPool::shared())
+    , mGeometry(std::make_shared<OGLGeometry>(ParticleSystem::generateParticleBuffers(0)))
+{}
+
+ParticleWorld::~ParticleWorld()
+{
+    for (const auto& emitter : mEmitters)
+    {
+        emitter->setInWorld(false);
+    }
+}
+
+bool ParticleWorld::add(std::shared_ptr<ParticleSystem> aSystem)
+{
+    if (!aSystem || aSystem->getBackend() != ParticleBackend::Cpu || aSystem->isInWorld() || mEmitters.size() >= cMaxEmitters)
+    {
+        return false;
+    }
+    aSystem->setInWorld(true);
+    mEmitters.push_back(std::move(aSystem));
+    mRing.reset();
+    return true;
+}
+
+void ParticleWorld::remove(const ParticleSystem& aSystem)
+{
+    const auto it = std::find_if(mEmitters.begin(), mEmitters.end(), [&](const auto& aEmitter) { return aEmitter.get() == &aSystem; });
+    if (it == mEmitters.end())
+    {
+        return;
+    }
+    (*it)->setInWorld(false);
+    mEmitters.erase(it);
+    mRing.reset();
+}
+
+void ParticleWorld::allocate()
+{
+    mInstanceCapacity = 0;
+    for (const auto& emitter : mEmitters)
+    {
+        mInstanceCapacity += emitter->getMaxParticles();
+    }
+    mRecords.resize(mEmitters.size());
+    mRing = std::make_unique<PersistentRingBuffer<3>>(mInstanceCapacity * sizeof(ParticleInstance) + mRecords.size() * sizeof(ParticleEmitterRecord));
+    mGeometry->buffer.storageBuffer = mRing->get();
+}
+
+void ParticleWorld::update()
+{
+    mDrawnCount = 0;
+    mGeometry->buffer.instanceCount = 0;
+    if (mEmitters.empty())
+    {
+        return;
+    }
+    if (!mRing)
+    {
+        allocate();
+    }
+
+    // Members are packed back to back; the chunks of all members are packed
+    // in parallel, as most members are far smaller than a chunk
+    struct PackTask
+    {
+        std::size_t emitter;
+        std::size_t begin;
+    };
+    std::vector<PackTask> tasks;
+    mFirstInstances.resize(mEmitters.size());
+    for (std::size_t e = 0; e < mEmitters.size(); ++e)
+    {
+        const ParticleSystem& emitter = *mEmitters[e];
+        mFirstInstances[e] = mDrawnCount;
+        const std::size_t alive = emitter.isSuspended() ? 0 : emitter.getAliveCount();
+        for (std::size_t begin = 0; begin < alive; begin += cParticleChunkSize)
+        {
+            tasks.push_back({ e, begin });
+        }
+        mDrawnCount += alive;
+
+        const glm::mat4 model = emitter.getModelMatrix();
+        const glm::vec3 origin = emitter.getSimulation().stepParams().emitterPos;
+        ParticleEmitterRecord& record = mRecords[e];
+        std::memcpy(record.modelMatrix, &model[0][0], sizeof(record.modelMatrix));
+        record.origin[0] = origin.x;
+        record.origin[1] = origin.y;
+        record.origin[2] = origin.z;
+        record.sizeScale = emitter.getParticleSizeScale();
+    }
+
+    auto* region = static_cast<std::byte*>(mRing->acquireNextRegion());
+    auto* instances = reinterpret_cast<ParticleInstance*>(region);
+    mWorkerPool->parallelFor(tasks.size(), [&](std::size_t aTask) {
+        const PackTask& task = tasks[aTask];
+        const ParticleSystem& emitter = *mEmitters[task.emitter];
+        const ParticleStorage& particles = emitter.getSimulation().storage();
+        const std::size_t end = std::min<std::size_t>(emitter.getAliveCount(), task.begin + cParticleChunkSize);
+        packParticleInstances(particles, nullptr, task.begin, end, emitter.getSimulation().stepParams().emitterPos,
+            emitter.getInterpolation(), instances + mFirstInstances[task.emitter], static_cast<std::uint16_t>(task.emitter));
+    });
+    std::memcpy(region + mInstanceCapacity * sizeof(ParticleInstance), mRecords.data(), mRecords.size() * sizeof(ParticleEmitterRecord));
+
+    // Offsets are in instances and in words of the shader storage buffer
+    const std::size_t offset = mRing->currentOffset();
+    const ParticleLifeCurves& curves = mEmitters.front()->getLifeCurves();
+    const ArrayDescription colors{ static_cast<int>(curves.colorSamples().size()), curves.colorSamples().data() };
+    const ArrayDescription sizes{ static_cast<int>(curves.sizeSamples().size()), curves.sizeSamples().data() };
+    for (auto& mode : mRenderInfos)
+    {
+        MaterialParameterValues& values = mode.second.materialParams.mParameterValues;
+        values["u_firstInstance"] = static_cast<unsigned>(offset / sizeof(ParticleInstance));
+        values["u_emitterRecords"] = static_cast<unsigned>((offset + mInstanceCapacity * sizeof(ParticleInstance)) / sizeof(std::uint32_t));
+        values["u_colorOverLife[0]"] = colors;
+        values["u_sizeOverLife[0]"] = sizes;
+        values["u_ambientSH[0]"] = ArrayDescription{ 12, mEmitters.front()->getAmbientLight().coefficients().data() };
+    }
+    mGeometry->buffer.instanceCount = static_cast<unsigned>(mDrawnCount);
+}
+
+void ParticleWorld::updateCameraVectors(const glm::mat4& aViewMatrix)
+{
+    const glm::vec3 cameraRight = glm::normalize(glm::vec3(aViewMatrix[0][0], aViewMatrix[1][0], aViewMatrix[2][0]));
+    const glm::vec3 cameraUp = glm::normalize(glm::vec3(aViewMatrix[0][1], aViewMatrix[1][1], aViewMatrix[2][1]));
+    for (auto& mode : mRenderInfos)
+    {
+        mode.second.materialParams.mParameterValues["u_cameraRight"] = cameraRight;
+        mode.second.materialParams.mParameterValues["u_cameraUp"] = cameraUp;
+    }
+}
+
+std::shared_ptr<AGeometry> ParticleWorld::getGeometry(GeometryFactory& aGeometryFactory, RenderStyle aRenderStyle)
+{
+    return mGeometry;
+}
+
+void ParticleWorld::prepareRenderData(MaterialFactory& aMaterialFactory, GeometryFactory& aGeometryFactory)
+{
+    for (auto& mode : mRenderInfos)
+    {
+        // The program is shared with the single systems, which reset these
+        MaterialParameterValues& values = mode.second.materialParams.mParameterValues;
+        values["u_analytic"] = 0;
+        values["u_sharedPool"] = 1;
+        values["u_quadHalfSize"] = ParticleSystem::getQuadHalfSizePerScale();
+        values["u_firstInstance"] = 0u;
+        values["u_emitterRecords"] = 0u;
+        values.try_emplace("u_lightingMode", int(ParticleLighting::Fragment));
+        mode.second.shaderProgram = aMaterialFactory.getShaderProgram(mode.second.materialParams.mMaterialName);
+        getTextures(values, aMaterialFactory);
+        mode.second.geometry = getGeometry(aGeometryFactory, mode.second.materialParams.mRenderStyle);
+    }
+}
+
+std::optional<RenderData> ParticleWorld::getRenderData(const RenderOptions& aOptions) const
+{
+    // An instance count of zero would make OGLGeometry fall back to a plain draw
+    if (mDrawnCount == 0)
+    {
+        return std::optional<RenderData>();
+    }
+    return MeshObject::getRenderData(aOptions);
+}
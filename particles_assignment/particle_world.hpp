@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "mesh_object.hpp"
+#include "ogl_geometry_factory.hpp"
+#include "persistent_ring_buffer.hpp"
+#include "particle_system.h"
+#include "worker_pool.hpp"
+
+// Per-emitter data of a ParticleWorld draw, indexed by ParticleInstance::emitter
+struct ParticleEmitterRecord
+{
+    float modelMatrix[16];
+    // Emitter position the instance positions are relative to
+    float origin[3];
+    float sizeScale;
+};
+static_assert(sizeof(ParticleEmitterRecord) % 16 == 0, "Records follow the instances in the same buffer");
+
+/**
+ * @brief Draws the particles of many CPU particle systems with one draw call.
+ *
+ * The members keep simulating on their own (ParticleSystem::update()), but
+ * no longer upload or draw. update() packs the particles of all members
+ * into one shared, persistently mapped buffer, each instance tagged with the
+ * index of its emitter, and writes an emitter record (model matrix, origin,
+ * size scale) per member behind them. particle.vertex.glsl looks the record
+ * up per instance, so 100 torches cost one draw and one set of uniforms.
+ *
+ * The world is a scene object with its own materials; members share them.
+ * Color and size over life and the ambient light come from the first
+ * member. Particles are not depth sorted across emitters, which suits
+ * additive blending.
+ */
+class ParticleWorld : public MeshObject
+{
+public:
+    // Largest emitter index ParticleInstance::emitter can hold, plus one
+    static constexpr std::size_t cMaxEmitters = 65536;
+
+    ParticleWorld();
+    // Members go back to drawing themselves
+    ~ParticleWorld() override;
+
+    ParticleWorld(const ParticleWorld&) = delete;
+    ParticleWorld& operator=(const ParticleWorld&) = delete;
+
+    // Fails for other than CPU backends, systems in another world and
+    // once cMaxEmitters systems were added
+    bool add(std::shared_ptr<ParticleSystem> aSystem);
+    void remove(const ParticleSystem& aSystem);
+    std::size_t emitterCount() const { return mEmitters.size(); }
+    // Particles drawn by the last update()
+    std::size_t drawnCount() const { return mDrawnCount; }
+
+    // Call after the members were updated
+    void update();
+    void updateCameraVectors(const glm::mat4& aViewMatrix);
+
+    std::shared_ptr<AGeometry> getGeometry(GeometryFactory& aGeometryFactory, RenderStyle aRenderStyle) override;
+    void prepareRenderData(MaterialFactory& aMaterialFactory, GeometryFactory& aGeometryFactory) override;
+    // Nothing is drawn while no member has live particles
+    std::optional<RenderData> getRenderData(const RenderOptions& aOptions) const override;
+
+    // Worker pool used for instance packing, defaults to WorkerPool::shared()
+    void setWorkerPool(WorkerPool& aPool) { mWorkerPool = &aPool; }
+
+private:
+    void allocate();
+
+    std::vector<std::shared_ptr<ParticleSystem>> mEmitters;
+    WorkerPool* mWorkerPool;
+
+    // One region holds the instances of all members, getMaxParticles() each,
+    // followed by the emitter records. Reallocated when members change.
+    std::unique_ptr<PersistentRingBuffer<3>> mRing;
+    std::size_t mInstanceCapacity = 0;
+    std::vector<ParticleEmitterRecord> mRecords;
+    std::vector<std::size_t> mFirstInstances;
+    std::size_t mDrawnCount = 0;
+    std::shared_ptr<OGLGeometry> mGeometry;
+};
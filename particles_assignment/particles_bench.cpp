@@ -0,0 +1,261 @@
+// Headless benchmark of the CPU particle simulation, see
+// doc/particle_simulation.md. Prints one JSON document to stdout.
+//
+//   particles_bench [--particles 10000,100000,1000000] [--threads 1,4]
+//                   [--steps 300] [--warmup 60] [--separation 0.02]
+//                   [--snapshot FIRE_PARTICLES.snapshot]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "particle_simulation.hpp"
+#include "particle_snapshot.hpp"
+
+// Per live particle and step: the position is copied to the previous
+// position, updateParticles reads and writes position, velocity and life,
+// compactParticles reads life once more. Emission is not counted.
+constexpr double cStepBytesPerParticle = (3 + 3 + 7 + 7 + 1) * sizeof(float);
+
+struct BenchConfig
+{
+    std::vector<std::size_t> particleCounts = { 10000, 100000, 1000000 };
+    std::vector<std::size_t> threadCounts;
+    int steps = 300;
+    int warmup = 60;
+    float separationRadius = 0.0f;
+    // Starts every run from this state instead of a full pool; the particle
+    // counts must match the snapshot's capacity
+    std::string snapshot;
+};
+
+struct BenchResult
+{
+    std::size_t particles;
+    std::size_t threads;
+    double meanAlive;
+    double meanMs;
+    double p50Ms;
+    double p90Ms;
+    double p99Ms;
+    double maxMs;
+    double nsPerParticle;
+    double bandwidthGBs;
+};
+
+static std::vector<std::size_t> parseList(const std::string& aText)
+{
+    std::vector<std::size_t> values;
+    std::stringstream stream(aText);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        values.push_back(std::stoul(item));
+    }
+    return values;
+}
+
+static BenchConfig parseArguments(int argc, char** argv)
+{
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            throw std::invalid_argument("Missing value for " + arg);
+        }
+        const std::string value = argv[++i];
+        if (arg == "--particles")
+        {
+            config.particleCounts = parseList(value);
+        }
+        else if (arg == "--threads")
+        {
+            config.threadCounts = parseList(value);
+        }
+        else if (arg == "--steps")
+        {
+            config.steps = std::max(1, std::stoi(value));
+        }
+        else if (arg == "--warmup")
+        {
+            config.warmup = std::max(0, std::stoi(value));
+        }
+        else if (arg == "--separation")
+        {
+            config.separationRadius = std::stof(value);
+        }
+        else if (arg == "--snapshot")
+        {
+            config.snapshot = value;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+    }
+
+    if (config.threadCounts.empty())
+    {
+        config.threadCounts = { 1 };
+        if (WorkerPool::defaultThreadCount() > 1)
+        {
+            config.threadCounts.push_back(WorkerPool::defaultThreadCount());
+        }
+    }
+    return config;
+}
+
+static double percentile(const std::vector<double>& aSorted, double aFraction)
+{
+    const std::size_t index = static_cast<std::size_t>(aFraction * double(aSorted.size() - 1) + 0.5);
+    return aSorted[index];
+}
+
+static BenchResult runBenchmark(const BenchConfig& aConfig, std::size_t aParticles, std::size_t aThreads)
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr float cDt = 1.0f / 60.0f;
+
+    WorkerPool pool(static_cast<unsigned int>(aThreads));
+    ParticleSimulation simulation(aParticles, 0x5EED);
+    simulation.setWorkerPool(pool);
+    simulation.stepParams().separation.radius = aConfig.separationRadius;
+    simulation.stepParams().separation.strength = aConfig.separationRadius > 0.0f ? 2.0f : 0.0f;
+
+    if (!aConfig.snapshot.empty())
+    {
+        if (!loadParticleSnapshot(aConfig.snapshot, simulation))
+        {
+            throw std::runtime_error("Cannot load " + aConfig.snapshot + " with " + std::to_string(aParticles) + " particles");
+        }
+    }
+    else
+    {
+        // Start from a full pool, the default emission rate keeps it about full
+        simulation.emitter().burst(static_cast<unsigned int>(aParticles));
+    }
+    for (int step = 0; step < aConfig.warmup; ++step)
+    {
+        simulation.update(cDt);
+    }
+
+    std::vector<double> stepMs;
+    stepMs.reserve(aConfig.steps);
+    double aliveSum = 0.0;
+    for (int step = 0; step < aConfig.steps; ++step)
+    {
+        const auto start = Clock::now();
+        aliveSum += simulation.update(cDt);
+        stepMs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+
+    BenchResult result{};
+    result.particles = aParticles;
+    result.threads = pool.threadCount();
+    result.meanAlive = aliveSum / aConfig.steps;
+    for (double ms : stepMs)
+    {
+        result.meanMs += ms;
+    }
+    result.meanMs /= aConfig.steps;
+
+    std::sort(stepMs.begin(), stepMs.end());
+    result.p50Ms = percentile(stepMs, 0.50);
+    result.p90Ms = percentile(stepMs, 0.90);
+    result.p99Ms = percentile(stepMs, 0.99);
+    result.maxMs = stepMs.back();
+
+    if (result.meanAlive > 0.0)
+    {
+        result.nsPerParticle = result.meanMs * 1e6 / result.meanAlive;
+        result.bandwidthGBs = result.meanAlive * cStepBytesPerParticle / (result.meanMs * 1e6);
+    }
+    return result;
+}
+
+// Contents of a JSON string literal, e.g. for file paths
+static std::string escapeJson(const std::string& aText)
+{
+    std::string escaped;
+    for (const char c : aText)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char code[7];
+            std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned int>(c));
+            escaped += code;
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void writeJson(std::ostream& aStream, const BenchConfig& aConfig, const std::vector<BenchResult>& aResults)
+{
+    aStream << "{\n"
+        << "  \"benchmark\": \"particles_bench\",\n"
+        << "  \"kernel\": \"" << particleKernelName() << "\",\n"
+        << "  \"hardwareThreads\": " << WorkerPool::defaultThreadCount() << ",\n"
+        << "  \"steps\": " << aConfig.steps << ",\n"
+        << "  \"warmup\": " << aConfig.warmup << ",\n"
+        << "  \"separationRadius\": " << aConfig.separationRadius << ",\n"
+        << "  \"snapshot\": \"" << escapeJson(aConfig.snapshot) << "\",\n"
+        << "  \"bytesPerParticle\": " << cStepBytesPerParticle << ",\n"
+        << "  \"results\": [\n";
+    for (std::size_t i = 0; i < aResults.size(); ++i)
+    {
+        const BenchResult& r = aResults[i];
+        aStream << "    { \"particles\": " << r.particles
+            << ", \"threads\": " << r.threads
+            << ", \"meanAlive\": " << r.meanAlive
+            << ", \"meanMs\": " << r.meanMs
+            << ", \"p50Ms\": " << r.p50Ms
+            << ", \"p90Ms\": " << r.p90Ms
+            << ", \"p99Ms\": " << r.p99Ms
+            << ", \"maxMs\": " << r.maxMs
+            << ", \"nsPerParticle\": " << r.nsPerParticle
+            << ", \"bandwidthGBs\": " << r.bandwidthGBs
+            << " }" << (i + 1 < aResults.size() ? "," : "") << "\n";
+    }
+    aStream << "  ]\n}\n";
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const BenchConfig config = parseArguments(argc, argv);
+
+        std::vector<BenchResult> results;
+        for (std::size_t particles : config.particleCounts)
+        {
+            for (std::size_t threads : config.threadCounts)
+            {
+                results.push_back(runBenchmark(config, particles, threads));
+            }
+        }
+        writeJson(std::cout, config, results);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "particles_bench: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -4,10 +4,12 @@
 #include <iostream>
 #include <algorithm>
 #include <numeric>
+#include <memory>
 
 #include "camera.hpp"
 #include "ogl_material_factory.hpp"
 #include "ogl_geometry_factory.hpp"
+#include "particle_offscreen_pass.hpp"
 
 
 class Renderer
@@ -27,6 +29,18 @@ public:
 		GL_CHECK(glClearColor(0.0f, 0.0f, 0.0f, 1.0f));
 	}
 
+	// Particles are drawn at 1 / aDownsample of the screen resolution along
+	// each axis and upsampled, see ParticleOffscreenPass; 1 draws them directly.
+	void setParticleDownsample(int aDownsample)
+	{
+		mParticleDownsample = std::max(1, aDownsample);
+	}
+
+	int getParticleDownsample() const
+	{
+		return mParticleDownsample;
+	}
+
 	void clear()
 	{
 		GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
@@ -108,6 +122,16 @@ public:
 				return distA > distB;
 			});
 
+		const bool offscreen = mParticleDownsample > 1 && !transparentData.empty();
+		if (offscreen)
+		{
+			if (!mParticleOffscreenPass)
+			{
+				mParticleOffscreenPass = std::make_unique<ParticleOffscreenPass>(mMaterialFactory);
+			}
+			mParticleOffscreenPass->begin(mParticleDownsample, aCamera.near(), aCamera.far());
+		}
+
 		// Render in sorted order
 		for (size_t idx : indices)
 		{
@@ -126,6 +150,11 @@ public:
 			geometry.draw();
 		}
 
+		if (offscreen)
+		{
+			mParticleOffscreenPass->end();
+		}
+
 		GL_CHECK(glDisable(GL_BLEND));
 		GL_CHECK(glDepthMask(GL_TRUE));
 	}
@@ -172,4 +201,7 @@ protected:
 	std::shared_ptr<OGLShaderProgram> mShowNormalsShader;
 
 	OGLMaterialFactory& mMaterialFactory;
+
+	int mParticleDownsample = 1;
+	std::unique_ptr<ParticleOffscreenPass> mParticleOffscreenPass;
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <memory>
 #include <vector>
 #include <ranges>
+#include <string>
 #include <iostream>
 
 #include "vertex.hpp"
@@ -14,6 +15,7 @@
 #include "geometry_factory.hpp"
 #include "simple_scene.hpp"
 #include "particle_system.h"
+#include "particle_world.hpp"
 
 constexpr unsigned int DIFFUSE = 1;
 constexpr unsigned int SPECULAR = 1 << 1;
@@ -203,7 +205,7 @@ inline SimpleScene createMonkeyScene(MaterialFactory &aMaterialFactory, Geometry
 	return scene;
 }
 
-inline SimpleScene createParticleScene(MaterialFactory& aMaterialFactory, GeometryFactory& aGeometryFactory)
+inline SimpleScene createParticleScene(MaterialFactory& aMaterialFactory, GeometryFactory& aGeometryFactory, ParticleBackend aBackend = ParticleBackend::Cpu)
 {
 	SimpleScene scene;
 
@@ -238,9 +240,23 @@ inline SimpleScene createParticleScene(MaterialFactory& aMaterialFactory, Geomet
 	scene.addObject(rocket);
 
 	// Particle system
-	auto particleSystem = std::make_shared<ParticleSystem>(1000);
+	auto particleSystem = std::make_shared<ParticleSystem>(1000, aBackend);
 	particleSystem->setName("FIRE_PARTICLES");
 	particleSystem->setPosition(glm::vec3(0.0f, -0.45f, 0.0f));
+	particleSystem->setDepthSorting(true);
+	// Simulated at half the display rate, drawn interpolated
+	particleSystem->setSimulationRate(30.0f);
+	particleSystem->setTurbulence(std::make_shared<CurlNoiseField>(), 0.6f, 0.5f);
+	// Extent of the flame for off-screen suspension; the analytic backend
+	// does not measure its particles
+	particleSystem->setLocalBounds(ParticleBounds{ glm::vec3(-1.0f, -0.5f, -1.0f), glm::vec3(1.0f, 2.5f, 1.0f) });
+
+	// The flame bounces off the rocket instead of passing through it. The
+	// bake takes a few seconds and is cached next to the mesh.
+	const ObjMesh rocketMesh = loadOBJ("./data/geometry/rocket.obj");
+	auto rocketField = std::make_shared<MeshDistanceField>(MeshDistanceField::bakeCached(
+		rocketMesh, MeshDistanceFieldSettings(), "./data/geometry/rocket.sdf", WorkerPool::shared()));
+	particleSystem->setCollider(rocketField, glm::inverse(particleSystem->getModelMatrix()) * rocket->getModelMatrix());
 
 	particleSystem->addMaterial(
 		"solid",
@@ -260,5 +276,87 @@ inline SimpleScene createParticleScene(MaterialFactory& aMaterialFactory, Geomet
 	particleSystem->prepareRenderData(aMaterialFactory, aGeometryFactory);
 	scene.addObject(particleSystem);
 
+	if (aBackend == ParticleBackend::Cpu)
+	{
+		// Sparks spread evenly over the rocket hull, whatever its tessellation.
+		// The emitter sits at the origin, so the shape places the mesh with
+		// the rocket's model matrix.
+		using SparkSpawner = ParticleSpawner<MeshSurfaceShape, JitteredVelocity, RandomLifetime, SizeAndTint>;
+		using HullSparks = ParticleEffect<SparkSpawner, ConstantAcceleration, LinearDrag>;
+		SparkSpawner spawner;
+		spawner.shape = MeshSurfaceShape{ std::make_shared<MeshSurfaceSampler>(rocketMesh), rocket->getModelMatrix() };
+		spawner.velocity = JitteredVelocity{ glm::vec3(0.0f, 0.3f, 0.0f), glm::vec3(0.6f) };
+		spawner.lifetime = RandomLifetime{ 0.6f, 0.3f };
+		spawner.appearance = SizeAndTint{ 0.02f, 0.01f, glm::vec4(1.0f, 0.8f, 0.4f, 1.0f) };
+
+		auto sparks = std::make_shared<ParticleSystem>(500);
+		sparks->setName("HULL_SPARKS");
+		sparks->setEffect(HullSparks(spawner, ConstantAcceleration{ glm::vec3(0.0f, -1.0f, 0.0f) }, LinearDrag{ 1.5f }));
+		sparks->setSizeOverLife({ { 0.0f, 0.4f }, { 1.0f, 0.15f } });
+		sparks->setBoundingRadius(1.5f);
+		sparks->addMaterial(
+			"solid",
+			MaterialParameters(
+				"particle",
+				RenderStyle::Solid,
+				{
+					{"u_particleTexture", TextureInfo("particle.png")},
+					{"u_lightingMode", int(ParticleLighting::Vertex)},
+					{"u_lightPos", glm::vec3(2.0f, 2.0f, 2.0f)},
+					{"u_lightColor", glm::vec3(1.0f, 0.9f, 0.8f)},
+					{"u_lightIntensity", 1.0f}
+				}
+			)
+		);
+		sparks->prepareRenderData(aMaterialFactory, aGeometryFactory);
+		scene.addObject(sparks);
+	}
+
+	return scene;
+}
+
+// A grid of small fires drawn by one ParticleWorld, one draw call for all
+inline SimpleScene createParticleWorldScene(MaterialFactory& aMaterialFactory, GeometryFactory& aGeometryFactory)
+{
+	SimpleScene scene;
+
+	auto world = std::make_shared<ParticleWorld>();
+	world->setName("TORCH_PARTICLES");
+	constexpr int cTorchesPerRow = 10;
+	// Blue sky, dim warm ground
+	const ParticleAmbientSH ambient = ParticleAmbientSH::hemisphere(glm::vec3(0.2f, 0.25f, 0.35f), glm::vec3(0.1f, 0.07f, 0.05f));
+	for (int row = 0; row < cTorchesPerRow; ++row)
+	{
+		for (int column = 0; column < cTorchesPerRow; ++column)
+		{
+			// Members are updated as scene objects, but drawn by the world
+			auto torch = std::make_shared<ParticleSystem>(200);
+			torch->setName("TORCH_" + std::to_string(row * cTorchesPerRow + column));
+			torch->setPosition(glm::vec3(0.5f * (column - 0.5f * (cTorchesPerRow - 1)), -0.5f, 0.5f * (row - 0.5f * (cTorchesPerRow - 1))));
+			torch->setScale(glm::vec3(0.25f));
+			torch->setAmbientLight(ambient);
+			world->add(torch);
+			scene.addObject(torch);
+		}
+	}
+
+	world->addMaterial(
+		"solid",
+		MaterialParameters(
+			"particle",
+			RenderStyle::Solid,
+			{
+				{"u_particleTexture", TextureInfo("particle.png")},
+				// Lit per quad corner, the fill rate of 100 torches adds up
+				{"u_lightingMode", int(ParticleLighting::Vertex)},
+				{"u_lightPos", glm::vec3(2.0f, 2.0f, 2.0f)},
+				{"u_lightColor", glm::vec3(1.0f, 0.9f, 0.8f)},
+				{"u_lightIntensity", 1.0f}
+			}
+		)
+	);
+	world->prepareRenderData(aMaterialFactory, aGeometryFactory);
+	scene.addObject(world);
+
 	return scene;
 }
@@ -0,0 +1,35 @@
+// GLSL twin of utils/counter_rng.hpp. Changing one requires changing the
+// other, otherwise CPU and GPU particles stop matching.
+
+uint counterHash(uint value) {
+	value ^= value >> 16;
+	value *= 0x7FEB352Du;
+	value ^= value >> 15;
+	value *= 0x846CA68Bu;
+	value ^= value >> 16;
+	return value;
+}
+
+struct CounterRandom {
+	uint base;
+	uint counter;
+};
+
+// key is counterRandomKey(seed), computed on the CPU
+CounterRandom counterRandom(uint key, uint frame, uint index) {
+	return CounterRandom(counterHash(counterHash(key ^ counterHash(frame)) ^ index), 0u);
+}
+
+uint nextUint(inout CounterRandom random) {
+	return counterHash(random.base + 0x9E3779B9u * random.counter++);
+}
+
+// Uniform in [0, 1)
+float nextFloat(inout CounterRandom random) {
+	return float(nextUint(random) >> 8) * (1.0 / 16777216.0);
+}
+
+// Uniform in [-0.5, 0.5)
+float nextSigned(inout CounterRandom random) {
+	return nextFloat(random) - 0.5;
+}
@@ -5,18 +5,20 @@ uniform vec3 u_viewPos;
 uniform vec3 u_lightPos;
 uniform vec3 u_lightColor;
 uniform float u_lightIntensity;
+// ParticleLighting::Vertex takes f_lighting from the vertex shader
+const int PARTICLE_LIGHTING_VERTEX = 1;
+uniform int u_lightingMode;
 
 in vec2 f_texCoord;
 in vec4 f_color;
 in vec3 f_worldPos;
 in vec3 f_normal;
+in vec3 f_lighting;
 
 out vec4 out_fragColor;
 
-void main()
+vec3 phong()
 {
-    vec4 texColor = texture(u_particleTexture, f_texCoord);
-    
     vec3 normal = normalize(f_normal);
     vec3 lightDir = normalize(u_lightPos - f_worldPos);
     vec3 viewDir = normalize(u_viewPos - f_worldPos);
@@ -32,7 +34,15 @@ void main()
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
     vec3 specular = specularStrength * spec * u_lightColor;
     
-    vec3 result = (ambient + diffuse + specular) * texColor.rgb * f_color.rgb;
+    return ambient + diffuse + specular;
+}
+
+void main()
+{
+    vec4 texColor = texture(u_particleTexture, f_texCoord);
+    
+    vec3 lighting = u_lightingMode == PARTICLE_LIGHTING_VERTEX ? f_lighting : phong();
+    vec3 result = lighting * texColor.rgb * f_color.rgb;
     out_fragColor = vec4(result, texColor.a * f_color.a);
     
     float edge = length(f_texCoord - vec2(0.5)) * 2.0;
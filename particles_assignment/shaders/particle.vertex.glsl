@@ -1,34 +1,182 @@
-#version 330 core
+#version 430 core
 
 uniform mat4 u_modelMat;
 uniform mat4 u_viewMat;
 uniform mat4 u_projMat;
 uniform vec3 u_cameraRight;
 uniform vec3 u_cameraUp;
+uniform float u_sizeScale;
+// Instance positions are relative to the emitter
+uniform vec3 u_emitterPos;
+// Half edge length of the billboard quad per unit of particle scale
+uniform float u_quadHalfSize;
+// Index of the first particle of the draw; gl_InstanceID starts at 0
+uniform uint u_firstInstance;
 
-layout(location = 0) in vec3 in_vert;
-layout(location = 1) in vec3 in_normal;
-layout(location = 2) in vec2 in_texCoord;
+// Analytic backend: particles are evaluated from their spawn record at
+// u_stepFraction past step u_step, see AnalyticParticle
+uniform bool u_analytic;
+uniform uint u_step;
+uniform float u_stepFraction;
+uniform float u_stepDuration;
+uniform vec3 u_acceleration;
+uniform float u_lifeDecay;
 
-layout(location = 3) in vec3 in_offset;
-layout(location = 4) in vec4 in_color;
+// ParticleWorld: the instances of many emitters in one draw. The high half of
+// the last instance word indexes an emitter record (ParticleEmitterRecord,
+// 20 words) from word u_emitterRecords on, which replaces u_modelMat,
+// u_emitterPos and u_sizeScale.
+uniform bool u_sharedPool;
+uniform uint u_emitterRecords;
+
+// Lighting per quad corner (ParticleLighting::Vertex), otherwise the
+// fragment shader lights. u_ambientSH holds RGB per first order spherical
+// harmonics band, see ParticleAmbientSH.
+const int PARTICLE_LIGHTING_VERTEX = 1;
+uniform int u_lightingMode;
+uniform vec3 u_lightPos;
+uniform vec3 u_lightColor;
+uniform float u_lightIntensity;
+uniform float u_ambientSH[12];
+
+// Color and size over the normalized age, sampled at 0, 1/16, ..., 1
+// (ParticleLifeCurves)
+const int PARTICLE_CURVE_SAMPLES = 17;
+uniform float u_colorOverLife[4 * PARTICLE_CURVE_SAMPLES];
+uniform float u_sizeOverLife[PARTICLE_CURVE_SAMPLES];
+
+// Vertex pulling: one instance per particle, read from the bound buffer.
+// ParticleInstance (particle_kernels.hpp) is 4 words: half position relative
+// to the emitter and half scale, RGBA8 color, unorm16 life. With u_analytic
+// it holds AnalyticParticle records (particle_analytic.hpp) of 10 words.
+layout(std430, binding = 0) readonly buffer ParticleData { uint particleWords[]; };
+
+const uint PARTICLE_INSTANCE_WORDS = 4u;
+const uint ANALYTIC_PARTICLE_WORDS = 10u;
+const uint EMITTER_RECORD_WORDS = 20u;
 
 out vec2 f_texCoord;
 out vec4 f_color;
 out vec3 f_worldPos;
 out vec3 f_normal;
+out vec3 f_lighting;
+
+vec4 colorSample(int index)
+{
+    return vec4(u_colorOverLife[4 * index], u_colorOverLife[4 * index + 1], u_colorOverLife[4 * index + 2], u_colorOverLife[4 * index + 3]);
+}
+
+vec3 readVec3(uint base)
+{
+    return uintBitsToFloat(uvec3(particleWords[base], particleWords[base + 1u], particleWords[base + 2u]));
+}
+
+vec4 readVec4(uint base)
+{
+    return uintBitsToFloat(uvec4(particleWords[base], particleWords[base + 1u], particleWords[base + 2u], particleWords[base + 3u]));
+}
+
+vec3 ambientSH(vec3 normal)
+{
+    vec3 result = vec3(u_ambientSH[0], u_ambientSH[1], u_ambientSH[2]);
+    result += normal.x * vec3(u_ambientSH[3], u_ambientSH[4], u_ambientSH[5]);
+    result += normal.y * vec3(u_ambientSH[6], u_ambientSH[7], u_ambientSH[8]);
+    result += normal.z * vec3(u_ambientSH[9], u_ambientSH[10], u_ambientSH[11]);
+    return max(result, vec3(0.0));
+}
+
+// Position after aSteps steps of updateParticles(). Its explicit Euler steps
+// add up to p + v t + a t (t - dt) / 2 with t = aSteps * dt, exactly.
+vec3 analyticPosition(vec3 position, vec3 velocity, float aSteps)
+{
+    float t = aSteps * u_stepDuration;
+    return position + velocity * t + u_acceleration * (0.5 * t * (t - u_stepDuration));
+}
 
 void main(void)
 {
-    vec3 vertexPosition = in_offset + 
-        u_cameraRight * in_vert.x + 
-        u_cameraUp * in_vert.y;
+    // Triangle strip corners (+,+), (-,+), (+,-), (-,-)
+    vec2 corner = vec2((gl_VertexID & 1) == 0 ? 1.0 : -1.0, (gl_VertexID & 2) == 0 ? 1.0 : -1.0);
+    uint particle = u_firstInstance + uint(gl_InstanceID);
 
-    vec4 worldPos = u_modelMat * vec4(vertexPosition, 1.0);
+    mat4 modelMat = u_modelMat;
+    float sizeScale = u_sizeScale;
+    vec3 center;
+    vec4 color;
+    float life;
+    float particleScale;
+    if (u_analytic)
+    {
+        uint base = particle * ANALYTIC_PARTICLE_WORDS;
+        float initialLife = uintBitsToFloat(particleWords[base + 3u]);
+        uint spawnStep = particleWords[base + 8u];
+        // Particles are integrated once in the step that emits them
+        float steps = float(u_step - spawnStep) + 1.0;
+        float remainingLife = initialLife - u_lifeDecay * steps * u_stepDuration;
+        if (remainingLife <= 0.0)
+        {
+            // Dead or never written: the whole quad collapses outside the clip volume
+            gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+            return;
+        }
+        // Blended between the last two steps like packParticleInstances()
+        vec3 position = readVec3(base);
+        vec3 velocity = readVec3(base + 4u);
+        center = mix(analyticPosition(position, velocity, steps - 1.0), analyticPosition(position, velocity, steps), u_stepFraction);
+        color = unpackUnorm4x8(particleWords[base + 7u]);
+        life = remainingLife / initialLife;
+        particleScale = uintBitsToFloat(particleWords[base + 9u]);
+    }
+    else
+    {
+        uint base = particle * PARTICLE_INSTANCE_WORDS;
+        vec2 xy = unpackHalf2x16(particleWords[base]);
+        vec2 zScale = unpackHalf2x16(particleWords[base + 1u]);
+        vec3 emitterPos = u_emitterPos;
+        if (u_sharedPool)
+        {
+            uint record = u_emitterRecords + (particleWords[base + 3u] >> 16u) * EMITTER_RECORD_WORDS;
+            modelMat = mat4(readVec4(record), readVec4(record + 4u), readVec4(record + 8u), readVec4(record + 12u));
+            vec4 originScale = readVec4(record + 16u);
+            emitterPos = originScale.xyz;
+            sizeScale = originScale.w;
+        }
+        center = emitterPos + vec3(xy, zScale.x);
+        particleScale = zScale.y;
+        color = unpackUnorm4x8(particleWords[base + 2u]);
+        life = unpackUnorm2x16(particleWords[base + 3u]).x;
+    }
+
+    // life runs from 1 at spawn to 0 at death
+    float curvePosition = clamp(1.0 - life, 0.0, 1.0) * float(PARTICLE_CURVE_SAMPLES - 1);
+    int sampleIndex = min(int(curvePosition), PARTICLE_CURVE_SAMPLES - 2);
+    float sampleFraction = curvePosition - float(sampleIndex);
+    vec4 lifeColor = mix(colorSample(sampleIndex), colorSample(sampleIndex + 1), sampleFraction);
+    float lifeSize = mix(u_sizeOverLife[sampleIndex], u_sizeOverLife[sampleIndex + 1], sampleFraction);
+
+    float size = sizeScale * lifeSize * particleScale;
+    vec3 vertexPosition = center + 
+        u_cameraRight * corner.x * u_quadHalfSize * size + 
+        u_cameraUp * corner.y * u_quadHalfSize * size;
+
+    vec4 worldPos = modelMat * vec4(vertexPosition, 1.0);
     gl_Position = u_projMat * u_viewMat * worldPos;
     
-    f_texCoord = in_texCoord;
-    f_color = in_color;
+    f_texCoord = corner * 0.5 + 0.5;
+    f_color = color * lifeColor;
     f_worldPos = worldPos.xyz;
-    f_normal = normalize(mat3(u_modelMat) * in_normal);
+    f_normal = normalize(mat3(modelMat) * vec3(0.0, 0.0, 1.0));
+
+    f_lighting = vec3(1.0);
+    if (u_lightingMode == PARTICLE_LIGHTING_VERTEX)
+    {
+        // The corners bend the normal away from the camera direction, so the
+        // interpolated quad shades like a sphere instead of a flat card
+        vec3 facing = cross(u_cameraRight, u_cameraUp);
+        vec3 normal = normalize(mat3(modelMat) * (u_cameraRight * corner.x + u_cameraUp * corner.y + facing));
+        vec3 lightDir = normalize(u_lightPos - worldPos.xyz);
+        // Wrapped diffuse: light reaches past the terminator, as in a translucent volume
+        float diffuse = max((dot(normal, lightDir) + 0.5) / 1.5, 0.0);
+        f_lighting = ambientSH(normal) + diffuse * u_lightIntensity * u_lightColor;
+    }
 } 
\ No newline at end of file
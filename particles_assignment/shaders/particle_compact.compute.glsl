@@ -0,0 +1,20 @@
+#version 430 core
+
+#include "particle_state"
+
+layout(local_size_x = 256) in;
+
+// Copies the surviving particles into the target state. The order of
+// survivors depends on atomic scheduling; blending is additive, so the
+// image does not.
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= pooledCount() || SRC(PARTICLE_LIFE, i) <= 0.0) {
+		return;
+	}
+	uint j = atomicAdd(dstCommand.instanceCount, 1u);
+
+	for (uint stream = 0u; stream < PARTICLE_STREAM_COUNT; ++stream) {
+		DST(stream, j) = SRC(stream, i);
+	}
+}
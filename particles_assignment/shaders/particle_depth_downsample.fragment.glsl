@@ -0,0 +1,22 @@
+#version 430 core
+
+// Full resolution scene depth
+uniform sampler2D u_sceneDepth;
+// Screen pixels per target pixel along each axis
+uniform int u_downsample;
+
+// Writes the farthest scene depth of the block of screen pixels covered by
+// this target pixel, so particles behind thin geometry are still drawn.
+// ParticleOffscreenPass picks between texels by depth when upsampling.
+void main() {
+	ivec2 size = textureSize(u_sceneDepth, 0);
+	ivec2 origin = ivec2(gl_FragCoord.xy) * u_downsample;
+	float depth = 0.0;
+	for (int y = 0; y < u_downsample; ++y) {
+		for (int x = 0; x < u_downsample; ++x) {
+			ivec2 pixel = min(origin + ivec2(x, y), size - 1);
+			depth = max(depth, texelFetch(u_sceneDepth, pixel, 0).r);
+		}
+	}
+	gl_FragDepth = depth;
+}
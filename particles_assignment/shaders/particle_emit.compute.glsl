@@ -0,0 +1,48 @@
+#version 430 core
+
+#include "particle_state"
+#include "counter_rng"
+
+layout(local_size_x = 256) in;
+
+uniform uint u_seed;
+uniform uint u_frame;
+uniform vec3 u_emitterPos;
+
+void main() {
+	uint n = gl_GlobalInvocationID.x;
+	uint i = srcCommand.instanceCount + n;
+	if (i >= pooledCount()) {
+		return;
+	}
+
+	// Same draws in the same order as respawnParticle(). precise keeps the
+	// arithmetic unfused, so everything but the trigonometry is bit-identical
+	// to the CPU.
+	CounterRandom random = counterRandom(u_seed, u_frame, n);
+	precise float angle = nextSigned(random) * 2.0 * 3.14159;
+	precise float radius = nextSigned(random) * 0.5;
+	precise float z = nextSigned(random) * 0.5;
+
+	SRC(PARTICLE_POSITION_X, i) = u_emitterPos.x + radius * cos(angle);
+	SRC(PARTICLE_POSITION_Y, i) = u_emitterPos.y + radius * sin(angle);
+	SRC(PARTICLE_POSITION_Z, i) = u_emitterPos.z + z;
+
+	precise float velocityX = nextSigned(random) * 0.2;
+	precise float velocityY = 1.8 + nextSigned(random) * 0.7;
+	precise float velocityZ = nextSigned(random) * 0.4;
+	SRC(PARTICLE_VELOCITY_X, i) = velocityX;
+	SRC(PARTICLE_VELOCITY_Y, i) = velocityY;
+	SRC(PARTICLE_VELOCITY_Z, i) = velocityZ;
+
+	precise float life = 1.0 + nextSigned(random) * 0.7;
+	precise float scale = 0.05 + nextSigned(random) * 0.02;
+	SRC(PARTICLE_LIFE, i) = life;
+	SRC(PARTICLE_INITIAL_LIFE, i) = life;
+	SRC(PARTICLE_SCALE, i) = scale;
+
+	SRC(PARTICLE_COLOR_R, i) = 1.0;
+	SRC(PARTICLE_COLOR_G, i) = 1.0;
+	SRC(PARTICLE_COLOR_B, i) = 1.0;
+	SRC(PARTICLE_COLOR_A, i) = 1.0;
+}
@@ -0,0 +1,50 @@
+#version 430 core
+
+#include "particle_state"
+
+layout(local_size_x = 256) in;
+
+// Instance positions are stored relative to the emitter
+uniform vec3 u_emitterPos;
+// Blend between the previous and the current step, 1 is the current one
+uniform float u_interpolation;
+
+// Frustum culling, see GpuParticleCulling. The margins are the particle
+// radius times the length of each plane normal.
+uniform uint u_frustumCulling;
+uniform mat4 u_clipFromSimulation;
+uniform vec3 u_cullMarginLow;
+uniform vec3 u_cullMarginHigh;
+
+bool insideFrustum(vec3 position) {
+	vec4 clip = u_clipFromSimulation * vec4(position, 1.0);
+	return all(greaterThanEqual(clip.www + clip.xyz, -u_cullMarginLow))
+		&& all(greaterThanEqual(clip.www - clip.xyz, -u_cullMarginHigh));
+}
+
+// Writes the render instances of the visible live particles in the source
+// state, like packParticleInstances(), and counts them in the draw command.
+// Runs once per rendered frame, also on frames without a simulation step.
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= srcCommand.instanceCount) {
+		return;
+	}
+	vec3 current = vec3(SRC(PARTICLE_POSITION_X, i), SRC(PARTICLE_POSITION_Y, i), SRC(PARTICLE_POSITION_Z, i));
+	vec3 previous = vec3(SRC(PARTICLE_PREVIOUS_X, i), SRC(PARTICLE_PREVIOUS_Y, i), SRC(PARTICLE_PREVIOUS_Z, i));
+	vec3 interpolated = current * u_interpolation + previous * (1.0 - u_interpolation);
+	if (u_frustumCulling != 0u && !insideFrustum(interpolated)) {
+		return;
+	}
+	uint j = atomicAdd(dstCommand.instanceCount, 1u);
+
+	vec3 position = interpolated - u_emitterPos;
+	vec4 color = vec4(SRC(PARTICLE_COLOR_R, i), SRC(PARTICLE_COLOR_G, i), SRC(PARTICLE_COLOR_B, i), SRC(PARTICLE_COLOR_A, i));
+	float lifeNorm = clamp(SRC(PARTICLE_LIFE, i) / SRC(PARTICLE_INITIAL_LIFE, i), 0.0, 1.0);
+
+	uint base = j * PARTICLE_INSTANCE_WORDS;
+	instances[base + 0u] = packHalf2x16(position.xy);
+	instances[base + 1u] = packHalf2x16(vec2(position.z, SRC(PARTICLE_SCALE, i)));
+	instances[base + 2u] = packUnorm4x8(color);
+	instances[base + 3u] = packUnorm2x16(vec2(lifeNorm, 0.0));
+}
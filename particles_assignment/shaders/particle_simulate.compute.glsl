@@ -0,0 +1,47 @@
+#version 430 core
+
+#include "particle_state"
+
+layout(local_size_x = 256) in;
+
+// Per-step constants are premultiplied on the CPU exactly like in
+// updateParticlesScalar(), so both backends compute the same values.
+uniform float u_dt;
+uniform vec3 u_velocityStep;
+uniform float u_lifeStep;
+
+// Curl-noise field, see CurlNoiseField. A step of 0 means no field is bound.
+uniform sampler3D u_turbulenceField;
+uniform float u_turbulenceStep;
+uniform float u_turbulenceFrequency;
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= pooledCount()) {
+		return;
+	}
+	float life = SRC(PARTICLE_LIFE, i);
+	if (life <= 0.0) {
+		return;
+	}
+	// precise keeps the compiler from fusing into fma, which the CPU
+	// kernels do not use either
+	precise vec3 velocity = vec3(SRC(PARTICLE_VELOCITY_X, i), SRC(PARTICLE_VELOCITY_Y, i), SRC(PARTICLE_VELOCITY_Z, i));
+	precise vec3 position = vec3(SRC(PARTICLE_POSITION_X, i), SRC(PARTICLE_POSITION_Y, i), SRC(PARTICLE_POSITION_Z, i));
+	SRC(PARTICLE_PREVIOUS_X, i) = position.x;
+	SRC(PARTICLE_PREVIOUS_Y, i) = position.y;
+	SRC(PARTICLE_PREVIOUS_Z, i) = position.z;
+	if (u_turbulenceStep != 0.0) {
+		velocity += texture(u_turbulenceField, position * u_turbulenceFrequency).xyz * u_turbulenceStep;
+	}
+	position += velocity * u_dt;
+	velocity += u_velocityStep;
+
+	SRC(PARTICLE_POSITION_X, i) = position.x;
+	SRC(PARTICLE_POSITION_Y, i) = position.y;
+	SRC(PARTICLE_POSITION_Z, i) = position.z;
+	SRC(PARTICLE_VELOCITY_X, i) = velocity.x;
+	SRC(PARTICLE_VELOCITY_Y, i) = velocity.y;
+	SRC(PARTICLE_VELOCITY_Z, i) = velocity.z;
+	SRC(PARTICLE_LIFE, i) = life - u_lifeStep;
+}
@@ -0,0 +1,58 @@
+// Particle state shared by the particle_* compute shaders.
+//
+// The state buffers use the layout of ParticleStorage (particle_storage.hpp):
+// 16 float streams of u_streamStride (the padded particle count) each.
+// Live particles are packed at the front; their count is the instanceCount
+// of the indirect draw command, so rendering needs no CPU read back.
+
+const uint PARTICLE_POSITION_X = 0u;
+const uint PARTICLE_POSITION_Y = 1u;
+const uint PARTICLE_POSITION_Z = 2u;
+const uint PARTICLE_VELOCITY_X = 3u;
+const uint PARTICLE_VELOCITY_Y = 4u;
+const uint PARTICLE_VELOCITY_Z = 5u;
+const uint PARTICLE_LIFE = 6u;
+const uint PARTICLE_INITIAL_LIFE = 7u;
+const uint PARTICLE_SCALE = 8u;
+const uint PARTICLE_COLOR_R = 9u;
+const uint PARTICLE_COLOR_G = 10u;
+const uint PARTICLE_COLOR_B = 11u;
+const uint PARTICLE_COLOR_A = 12u;
+// Position before the last step, for render interpolation
+const uint PARTICLE_PREVIOUS_X = 13u;
+const uint PARTICLE_PREVIOUS_Y = 14u;
+const uint PARTICLE_PREVIOUS_Z = 15u;
+const uint PARTICLE_STREAM_COUNT = 16u;
+
+// Words per ParticleInstance (particle_kernels.hpp): half position relative
+// to the emitter and half scale, RGBA8 color, unorm16 life
+const uint PARTICLE_INSTANCE_WORDS = 4u;
+
+// DrawArraysIndirectCommand
+struct DrawCommand {
+	uint count;
+	uint instanceCount;
+	uint first;
+	uint baseInstance;
+};
+
+layout(std430, binding = 0) buffer SourceState { float srcState[]; };
+layout(std430, binding = 1) buffer SourceCommand { DrawCommand srcCommand; };
+layout(std430, binding = 2) buffer TargetState { float dstState[]; };
+layout(std430, binding = 3) buffer TargetCommand { DrawCommand dstCommand; };
+layout(std430, binding = 4) buffer Instances { uint instances[]; };
+
+uniform uint u_streamStride;
+// Emission stops at this many live particles (at most the capacity)
+uniform uint u_particleQuota;
+uniform uint u_emitCount;
+
+#define SRC(stream, i) srcState[(stream) * u_streamStride + (i)]
+#define DST(stream, i) dstState[(stream) * u_streamStride + (i)]
+
+// Particles in the source state after this frame's emission. A lowered
+// quota only stops emission, particles above it die out on their own.
+uint pooledCount() {
+	uint alive = srcCommand.instanceCount;
+	return max(alive, min(alive + u_emitCount, u_particleQuota));
+}
@@ -0,0 +1,45 @@
+#version 430 core
+
+// Low resolution particles and the depth they were tested against
+uniform sampler2D u_particleColor;
+uniform sampler2D u_particleDepth;
+// Full resolution scene depth
+uniform sampler2D u_sceneDepth;
+uniform float u_near;
+uniform float u_far;
+
+in vec2 texCoords;
+
+out vec4 fragColor;
+
+// Relative difference of view depths below which two samples are one surface
+const float DEPTH_TOLERANCE = 0.05;
+
+float linearDepth(float depth) {
+	float ndc = depth * 2.0 - 1.0;
+	return 2.0 * u_near * u_far / (u_far + u_near - ndc * (u_far - u_near));
+}
+
+// Nearest-depth upsampling: bilinear where the four low resolution texels
+// around this pixel lie on the same surface as the pixel, otherwise the
+// texel with the closest depth, which keeps particles from bleeding across
+// depth edges.
+void main() {
+	float depth = linearDepth(texelFetch(u_sceneDepth, ivec2(gl_FragCoord.xy), 0).r);
+	ivec2 lowSize = textureSize(u_particleColor, 0);
+	ivec2 base = ivec2(floor(texCoords * vec2(lowSize) - 0.5));
+
+	ivec2 nearest = clamp(base, ivec2(0), lowSize - 1);
+	float nearestDifference = 1e30;
+	bool continuous = true;
+	for (int i = 0; i < 4; ++i) {
+		ivec2 texel = clamp(base + ivec2(i & 1, i >> 1), ivec2(0), lowSize - 1);
+		float difference = abs(linearDepth(texelFetch(u_particleDepth, texel, 0).r) - depth);
+		if (difference < nearestDifference) {
+			nearestDifference = difference;
+			nearest = texel;
+		}
+		continuous = continuous && difference < DEPTH_TOLERANCE * depth;
+	}
+	fragColor = continuous ? texture(u_particleColor, texCoords) : texelFetch(u_particleColor, nearest, 0);
+}
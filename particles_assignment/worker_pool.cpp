@@ -0,0 +1,119 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <utility>
+
+WorkerPool::WorkerPool(unsigned int aThreadCount)
+{
+    aThreadCount = std::max(1u, aThreadCount);
+    mThreads.reserve(aThreadCount - 1);
+    for (unsigned int i = 1; i < aThreadCount; ++i)
+    {
+        mThreads.emplace_back([this] { workerLoop(); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWakeCondition.notify_all();
+    for (auto& thread : mThreads)
+    {
+        thread.join();
+    }
+}
+
+void WorkerPool::parallelFor(std::size_t aTaskCount, const std::function<void(std::size_t)>& aTask)
+{
+    if (aTaskCount == 0)
+    {
+        return;
+    }
+    if (mThreads.empty() || aTaskCount == 1)
+    {
+        for (std::size_t i = 0; i < aTaskCount; ++i)
+        {
+            aTask(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTask = &aTask;
+        mTaskCount = aTaskCount;
+        mNextTask.store(0);
+        mError = nullptr;
+        mBusyWorkers = static_cast<unsigned int>(mThreads.size());
+        ++mGeneration;
+    }
+    mWakeCondition.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDoneCondition.wait(lock, [this] { return mBusyWorkers == 0; });
+    mTask = nullptr;
+    if (mError)
+    {
+        std::rethrow_exception(std::exchange(mError, nullptr));
+    }
+}
+
+void WorkerPool::runTasks()
+{
+    for (std::size_t i = mNextTask.fetch_add(1); i < mTaskCount; i = mNextTask.fetch_add(1))
+    {
+        try
+        {
+            (*mTask)(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (!mError)
+            {
+                mError = std::current_exception();
+            }
+        }
+    }
+}
+
+void WorkerPool::workerLoop()
+{
+    std::size_t seenGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWakeCondition.wait(lock, [&] { return mStopping || mGeneration != seenGeneration; });
+            if (mStopping)
+            {
+                return;
+            }
+            seenGeneration = mGeneration;
+        }
+
+        runTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            --mBusyWorkers;
+        }
+        mDoneCondition.notify_one();
+    }
+}
+
+unsigned int WorkerPool::defaultThreadCount()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+WorkerPool& WorkerPool::shared()
+{
+    static WorkerPool pool;
+    return pool;
+}
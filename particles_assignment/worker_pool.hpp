@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads executing indexed tasks.
+ *
+ * parallelFor() hands out task indices dynamically, so the thread a task
+ * runs on is not deterministic. Callers that need reproducible results must
+ * make each task depend only on its index.
+ */
+class WorkerPool
+{
+public:
+    // aThreadCount includes the calling thread, which also executes tasks.
+    explicit WorkerPool(unsigned int aThreadCount = defaultThreadCount());
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Runs aTask(i) for every i in [0, aTaskCount) and returns when all are done.
+    // The first exception thrown by a task is rethrown on the calling thread.
+    void parallelFor(std::size_t aTaskCount, const std::function<void(std::size_t)>& aTask);
+
+    unsigned int threadCount() const { return static_cast<unsigned int>(mThreads.size()) + 1; }
+
+    static unsigned int defaultThreadCount();
+
+    // Pool shared by all particle systems, sized to the hardware.
+    static WorkerPool& shared();
+
+private:
+    void workerLoop();
+    void runTasks();
+
+    std::vector<std::thread> mThreads;
+
+    std::mutex mMutex;
+    std::condition_variable mWakeCondition;
+    std::condition_variable mDoneCondition;
+    std::size_t mGeneration = 0;
+    unsigned int mBusyWorkers = 0;
+    bool mStopping = false;
+
+    const std::function<void(std::size_t)>* mTask = nullptr;
+    std::size_t mTaskCount = 0;
+    std::atomic<std::size_t> mNextTask{ 0 };
+    std::exception_ptr mError;
+};
@@ -77,6 +77,15 @@ public:
 		return farPlane;
 	}
 
+	// Vertical field of view in degrees
+	float fieldOfView() const {
+		return fov;
+	}
+
+	float getAspectRatio() const {
+		return aspectRatio;
+	}
+
 private:
 	float fov;          // Field of view in radians
 	float aspectRatio;  // Aspect ratio of the viewport
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Stateless counter-based random numbers.
+ *
+ * Every value is a pure function of (key, frame, index, draw), so it does not
+ * matter which thread, SIMD lane or shader invocation computes it. Only 32-bit
+ * integer multiply, xor and shift are used; the same functions exist in GLSL
+ * (counter_rng.include.glsl) and produce bit-identical results.
+ *
+ * Floats are built from the top 24 bits, which makes the conversion exact on
+ * every platform.
+ */
+
+/**
+ * @brief 32-bit integer finalizer ("lowbias32"), a bijection on uint32.
+ */
+constexpr std::uint32_t counterHash(std::uint32_t aValue) {
+	aValue ^= aValue >> 16;
+	aValue *= 0x7FEB352Du;
+	aValue ^= aValue >> 15;
+	aValue *= 0x846CA68Bu;
+	aValue ^= aValue >> 16;
+	return aValue;
+}
+
+/**
+ * @brief Folds a 64-bit seed into the 32-bit key used by CounterRandom.
+ */
+constexpr std::uint32_t counterRandomKey(std::uint64_t aSeed) {
+	return counterHash(static_cast<std::uint32_t>(aSeed) ^ counterHash(static_cast<std::uint32_t>(aSeed >> 32)));
+}
+
+/**
+ * @brief Random stream of one item (e.g. a particle) in one frame.
+ */
+class CounterRandom {
+public:
+	constexpr CounterRandom(std::uint32_t aKey, std::uint32_t aFrame, std::uint32_t aIndex)
+		: mBase(counterHash(counterHash(aKey ^ counterHash(aFrame)) ^ aIndex))
+	{}
+
+	constexpr std::uint32_t nextUint() {
+		return counterHash(mBase + 0x9E3779B9u * mCounter++);
+	}
+
+	/**
+	 * @return Uniform float in [0, 1).
+	 */
+	constexpr float nextFloat() {
+		return static_cast<float>(nextUint() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	/**
+	 * @return Uniform float in [-0.5, 0.5).
+	 */
+	constexpr float nextSigned() {
+		return nextFloat() - 0.5f;
+	}
+
+private:
+	std::uint32_t mBase;
+	std::uint32_t mCounter = 0;
+};
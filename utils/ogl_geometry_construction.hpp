@@ -10,7 +10,18 @@ struct IndexedBuffer {
 	std::vector<OpenGLResource> vbos;
 	unsigned int indexCount = 0;
 	unsigned int instanceCount = 0;
+	unsigned int baseInstance = 0;
+	// When set, draws read a DrawElementsIndirectCommand from this buffer
+	// (not owned) instead of using indexCount and instanceCount.
+	GLuint indirectBuffer = 0;
 	GLenum mode = GL_TRIANGLES;
+	// Without an index buffer, indexCount vertices are drawn with
+	// glDrawArrays* and an indirect buffer holds a DrawArraysIndirectCommand.
+	bool indexed = true;
+	// When set, bind() also binds this buffer (not owned) to the shader
+	// storage binding storageBinding, for vertex shaders that pull their data
+	GLuint storageBuffer = 0;
+	GLuint storageBinding = 0;
 };
 
 inline glm::vec3 insertDimension(const glm::vec2& v, int dimension, float value) {
@@ -21,6 +21,9 @@ public:
 
 	void bind() const {
 		GL_CHECK(glBindVertexArray(buffer.vao.get()));
+		if (buffer.storageBuffer != 0) {
+			GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, buffer.storageBinding, buffer.storageBuffer));
+		}
 	}
 
 	void draw() const {
@@ -28,10 +31,29 @@ public:
 	}
 
 	void draw(GLenum aMode) const {
-		if (buffer.instanceCount == 0) {
+		if (!buffer.indexed) {
+			drawArrays(aMode);
+		} else if (buffer.indirectBuffer != 0) {
+			GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer.indirectBuffer));
+			GL_CHECK(glDrawElementsIndirect(aMode, GL_UNSIGNED_INT, reinterpret_cast<void*>(0)));
+			GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+		} else if (buffer.instanceCount == 0) {
 			GL_CHECK(glDrawElements(aMode, buffer.indexCount, GL_UNSIGNED_INT, reinterpret_cast<void*>(0)));
 		} else {
-			GL_CHECK(glDrawElementsInstanced(aMode, buffer.indexCount, GL_UNSIGNED_INT, reinterpret_cast<void*>(0), buffer.instanceCount));
+			GL_CHECK(glDrawElementsInstancedBaseInstance(aMode, buffer.indexCount, GL_UNSIGNED_INT, reinterpret_cast<void*>(0), buffer.instanceCount, buffer.baseInstance));
+		}
+	}
+
+private:
+	void drawArrays(GLenum aMode) const {
+		if (buffer.indirectBuffer != 0) {
+			GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer.indirectBuffer));
+			GL_CHECK(glDrawArraysIndirect(aMode, reinterpret_cast<void*>(0)));
+			GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+		} else if (buffer.instanceCount == 0) {
+			GL_CHECK(glDrawArrays(aMode, 0, buffer.indexCount));
+		} else {
+			GL_CHECK(glDrawArraysInstancedBaseInstance(aMode, 0, buffer.indexCount, buffer.instanceCount, buffer.baseInstance));
 		}
 	}
 };
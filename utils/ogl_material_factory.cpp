@@ -521,6 +521,20 @@ OpenGLResource create3DTextureFromData(const VolumeData& volumeData) {
 	return texture;
 }
 
+OpenGLResource createTiled3DTextureFromData(const float* aRgba, int aWidth, int aHeight, int aDepth) {
+	auto texture = createTexture();
+	GL_CHECK(glBindTexture(GL_TEXTURE_3D, texture.get()));
+	GL_CHECK(glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32F, aWidth, aHeight, aDepth, 0, GL_RGBA, GL_FLOAT, aRgba));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT));
+	GL_CHECK(glBindTexture(GL_TEXTURE_3D, 0));
+
+	return texture;
+}
+
 void OGLMaterialFactory::load3DTexturesFromDir(fs::path aTextureDir) {
 	aTextureDir = fs::canonical(aTextureDir);
 	auto files = findVolumeDataFiles(aTextureDir);
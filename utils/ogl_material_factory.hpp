@@ -168,3 +168,11 @@ struct ImageData {
 
 std::unique_ptr<ImageData> loadImage(const fs::path& filePath);
 OpenGLResource createTextureFromData(const ImageData& imgData);
+
+/**
+ * @brief Creates a tileable RGBA float volume (repeat wrapping, trilinear filtering).
+ *
+ * Same upload path as the volume textures from load3DTexturesFromDir(), but
+ * for four-component data such as a baked vector field.
+ */
+OpenGLResource createTiled3DTextureFromData(const float* aRgba, int aWidth, int aHeight, int aDepth);
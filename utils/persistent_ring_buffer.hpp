@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <array>
+#include <cstddef>
+
+#include "ogl_resource.hpp"
+#include "error_handling.hpp"
+
+/**
+ * @brief Buffer object split into N regions that stay mapped for the
+ *		whole lifetime of the buffer (GL 4.4 buffer storage).
+ *
+ * The CPU writes region k while the GPU may still read the other regions.
+ * A fence per region prevents overwriting data that has not been consumed
+ * yet. Regions are fenced lazily: when region k+1 is acquired, every draw
+ * reading region k has already been submitted.
+ */
+template<std::size_t tRegionCount = 3>
+class PersistentRingBuffer {
+public:
+	PersistentRingBuffer() = default;
+
+	/**
+	 * @param aRegionSize Size of one region in bytes.
+	 * @param aTarget     Binding point used while creating the storage.
+	 */
+	explicit PersistentRingBuffer(std::size_t aRegionSize, GLenum aTarget = GL_ARRAY_BUFFER)
+		: mBuffer(createBuffer())
+		, mRegionSize(aRegionSize)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		const GLsizeiptr totalSize = GLsizeiptr(mRegionSize * tRegionCount);
+
+		GL_CHECK(glBindBuffer(aTarget, mBuffer.get()));
+		GL_CHECK(glBufferStorage(aTarget, totalSize, nullptr, flags));
+		mMapped = static_cast<std::byte*>(glMapBufferRange(aTarget, 0, totalSize, flags));
+		GL_CHECK(glBindBuffer(aTarget, 0));
+		if (!mMapped) {
+			throw OpenGLError("Failed to persistently map ring buffer");
+		}
+	}
+
+	~PersistentRingBuffer() {
+		for (auto &fence : mFences) {
+			if (fence) {
+				glDeleteSync(fence);
+			}
+		}
+		// Deleting the buffer object implicitly unmaps it.
+	}
+
+	PersistentRingBuffer(const PersistentRingBuffer&) = delete;
+	PersistentRingBuffer& operator=(const PersistentRingBuffer&) = delete;
+
+	/**
+	 * @brief Fences the region written last, advances to the next region
+	 *		and blocks until the GPU has finished reading it.
+	 * @return Pointer to the start of the now writable region.
+	 */
+	void *acquireNextRegion() {
+		if (mHasWritten) {
+			mFences[mCurrentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			mCurrentRegion = (mCurrentRegion + 1) % tRegionCount;
+		}
+		waitForRegion(mCurrentRegion);
+		mHasWritten = true;
+		return mMapped + mCurrentRegion * mRegionSize;
+	}
+
+	GLuint get() const { return mBuffer.get(); }
+	std::size_t regionSize() const { return mRegionSize; }
+	std::size_t currentRegion() const { return mCurrentRegion; }
+	std::size_t currentOffset() const { return mCurrentRegion * mRegionSize; }
+
+	static constexpr std::size_t regionCount() { return tRegionCount; }
+
+private:
+	void waitForRegion(std::size_t aRegion) {
+		GLsync &fence = mFences[aRegion];
+		if (!fence) {
+			return;
+		}
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		while (result == GL_TIMEOUT_EXPIRED) {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		}
+		if (result == GL_WAIT_FAILED) {
+			throw OpenGLError("Waiting on ring buffer fence failed");
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	OpenGLResource mBuffer;
+	std::byte *mMapped = nullptr;
+	std::size_t mRegionSize = 0;
+	std::size_t mCurrentRegion = 0;
+	bool mHasWritten = false;
+	std::array<GLsync, tRegionCount> mFences{};
+};